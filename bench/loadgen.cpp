@@ -0,0 +1,429 @@
+// HTTP load generator for the experiments server: keeps N keep-alive connections busy with
+// a weighted mix of URLs (optionally pipelined) and reports throughput and latency percentiles
+#include "histogram.hpp"
+#include <asio.hpp>
+#include <fmt/format.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+using std::string;
+using std::string_view;
+using clock_type = std::chrono::steady_clock;
+
+struct Options {
+  string host = "127.0.0.1";
+  std::vector<string> ports{ "8888", "7777" };
+  int connections = 64;
+  int depth = 1;  // requests sent at once on a connection
+  int threads = int(std::max(1u, std::thread::hardware_concurrency()));
+  int duration = 10;  // seconds
+  string mix = "/=1,/many_photos=1,/photo{n}.jpg=36,/favicon.ico=1,/missing=1";
+  string output;  // JSON result file
+};
+
+// URL with its relative weight; "{n}" in the URL is replaced with a random photo number 1..36
+struct MixEntry {
+  string url;
+  unsigned weight;
+};
+
+// per-thread results, merged at the end
+struct Stats {
+  Histogram latency;  // microseconds, from sending a request to the last byte of its response
+  uint64_t requests = 0;
+  uint64_t bytes = 0;
+  uint64_t errors = 0;
+  uint64_t reconnects = 0;
+  std::map<int, uint64_t> statuses;
+
+  void merge(const Stats& other) {
+    latency.merge(other.latency);
+    requests += other.requests;
+    bytes += other.bytes;
+    errors += other.errors;
+    reconnects += other.reconnects;
+    for (auto [status, count] : other.statuses)
+      statuses[status] += count;
+  }
+};
+
+std::vector<string> split(string_view text, char separator) {
+  std::vector<string> items;
+  while (!text.empty()) {
+    auto item = text.substr(0, text.find(separator));
+    items.emplace_back(item);
+    text.remove_prefix(std::min(text.size(), item.size() + 1));
+  }
+  return items;
+}
+
+std::vector<MixEntry> parse_mix(string_view text) {
+  std::vector<MixEntry> mix;
+  for (auto& item : split(text, ',')) {
+    auto eq = item.rfind('=');
+    int weight = eq == string::npos ? 1 : std::atoi(item.c_str() + eq + 1);
+    if (item.empty() || item[0] != '/' || weight <= 0)
+      throw std::invalid_argument(fmt::format("bad mix entry {}, expected /url=weight", item));
+    mix.push_back({ item.substr(0, eq), unsigned(weight) });
+  }
+  return mix;
+}
+
+bool iequals(string_view a, string_view b) {
+  return a.size() == b.size() &&
+    std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) { return (x | 0x20) == (y | 0x20); });
+}
+
+// response header fields the generator needs
+struct ResponseHead {
+  int status = 0;
+  size_t content_length = 0;
+  bool close = false;
+};
+
+bool parse_head(string_view head, ResponseHead& result) {
+  // status line: HTTP/1.1 SP status SP reason
+  if (!head.starts_with("HTTP/1.") || head.size() < 12)
+    return false;
+  result = {};
+  result.status = std::atoi(head.data() + 9);
+  while (true) {
+    auto line_end = head.find("\r\n");
+    if (line_end == string_view::npos || line_end == 0)
+      break;
+    head.remove_prefix(line_end + 2);
+    auto line = head.substr(0, head.find("\r\n"));
+    auto colon = line.find(':');
+    if (colon == string_view::npos)
+      continue;
+    auto name = line.substr(0, colon);
+    auto value = line.substr(colon + 1);
+    while (!value.empty() && value.front() == ' ')
+      value.remove_prefix(1);
+    if (iequals(name, "Content-Length"))
+      result.content_length = size_t(std::strtoull(string(value).c_str(), nullptr, 10));
+    else if (iequals(name, "Connection") && iequals(value, "close"))
+      result.close = true;
+  }
+  return result.status != 0;
+}
+
+class Connection
+{
+public:
+  Connection(asio::io_context& context, const Options& options, const std::vector<MixEntry>& mix,
+    asio::ip::tcp::endpoint endpoint, Stats& stats, const std::atomic_bool& stop, unsigned seed) :
+    socket(context),
+    retry_timer(context),
+    options(options),
+    mix(mix),
+    endpoint(endpoint),
+    stats(stats),
+    stop(stop),
+    random(seed) {
+    for (auto& entry : mix)
+      total_weight += entry.weight;
+  }
+
+  asio::awaitable<void> run() {
+    while (!stop) {
+      std::error_code ec;
+      if (!socket.is_open()) {
+        co_await socket.async_connect(endpoint, asio::redirect_error(asio::use_awaitable, ec));
+        if (ec) {
+          ++stats.errors;
+          socket.close(ec);
+          // the server is down or refuses connections, don't spin on it
+          retry_timer.expires_after(std::chrono::milliseconds(100));
+          co_await retry_timer.async_wait(asio::redirect_error(asio::use_awaitable, ec));
+          continue;
+        }
+        socket.set_option(asio::ip::tcp::no_delay(true), ec);
+      }
+      if (!co_await exchange()) {
+        ++stats.reconnects;
+        socket.close(ec);
+        begin = end = 0;
+      }
+    }
+  }
+
+private:
+  const string& next_url() {
+    auto pick = std::uniform_int_distribution<unsigned>(0, total_weight - 1)(random);
+    for (auto& entry : mix) {
+      if (pick < entry.weight) {
+        auto placeholder = entry.url.find("{n}");
+        if (placeholder == string::npos)
+          return entry.url;
+        url = entry.url;
+        url.replace(placeholder, 3, std::to_string(std::uniform_int_distribution<int>(1, 36)(random)));
+        return url;
+      }
+      pick -= entry.weight;
+    }
+    return mix.back().url;
+  }
+
+  // sends depth requests in one write and reads all responses; responses completed after the
+  // stop aren't counted, they are outside the measured time. Returns false if the connection
+  // has to be reopened
+  asio::awaitable<bool> exchange() {
+    requests.clear();
+    for (int i = 0; i < options.depth; ++i)
+      fmt::format_to(std::back_inserter(requests), "GET {} HTTP/1.1\r\nHost: {}\r\n\r\n", next_url(), options.host);
+    auto sent = clock_type::now();
+    std::error_code ec;
+    co_await asio::async_write(socket, asio::buffer(requests), asio::redirect_error(asio::use_awaitable, ec));
+    if (ec) {
+      if (!stop)
+        ++stats.errors;
+      co_return false;
+    }
+    for (int i = 0; i < options.depth; ++i) {
+      ResponseHead head;
+      response_bytes = 0;
+      if (!co_await read_response(head)) {
+        if (!stop)
+          ++stats.errors;
+        co_return false;
+      }
+      if (stop)
+        co_return true;
+      stats.bytes += response_bytes;
+      auto latency = std::chrono::duration_cast<std::chrono::microseconds>(clock_type::now() - sent);
+      stats.latency.add(uint64_t(latency.count()));
+      ++stats.requests;
+      ++stats.statuses[head.status];
+      if (head.close)
+        co_return false;
+    }
+    co_return true;
+  }
+
+  // reads one response, the body is counted and discarded
+  asio::awaitable<bool> read_response(ResponseHead& head) {
+    constexpr string_view terminator = "\r\n\r\n";
+    size_t checked = 0;  // bytes after begin known not to contain the terminator start
+    while (true) {
+      auto from = buffer.data() + begin + checked;
+      auto found = std::search(from, buffer.data() + end, terminator.begin(), terminator.end());
+      if (found != buffer.data() + end) {
+        auto head_size = size_t(found - (buffer.data() + begin)) + terminator.size();
+        if (!parse_head({ buffer.data() + begin, head_size }, head))
+          co_return false;
+        begin += head_size;
+        response_bytes += head_size;
+        break;
+      }
+      checked = std::max(end - begin, terminator.size() - 1) - (terminator.size() - 1);
+      if (!co_await fill())
+        co_return false;
+    }
+    size_t body_left = head.content_length;
+    while (true) {
+      auto take = std::min(body_left, end - begin);
+      begin += take;
+      body_left -= take;
+      response_bytes += take;
+      if (!body_left)
+        co_return true;
+      if (!co_await fill())
+        co_return false;
+    }
+  }
+
+  // reads more data after the unconsumed part of the buffer
+  asio::awaitable<bool> fill() {
+    if (begin == end)
+      begin = end = 0;
+    else if (begin > buffer.size() / 2) {
+      std::memmove(buffer.data(), buffer.data() + begin, end - begin);
+      end -= begin;
+      begin = 0;
+    }
+    if (end == buffer.size())
+      buffer.resize(buffer.size() * 2);
+    std::error_code ec;
+    auto size = co_await socket.async_read_some(
+      asio::buffer(buffer.data() + end, buffer.size() - end), asio::redirect_error(asio::use_awaitable, ec));
+    end += size;
+    co_return !ec;
+  }
+
+  asio::ip::tcp::socket socket;
+  asio::steady_timer retry_timer;
+  const Options& options;
+  const std::vector<MixEntry>& mix;
+  asio::ip::tcp::endpoint endpoint;
+  Stats& stats;
+  const std::atomic_bool& stop;
+  std::minstd_rand random;
+  unsigned total_weight = 0;
+  string url;
+  string requests;
+  std::vector<char> buffer = std::vector<char>(64 * 1024);
+  size_t begin = 0;
+  size_t end = 0;
+  size_t response_bytes = 0;
+};
+
+Options parse_options(int argc, char* argv[]) {
+  constexpr string_view usage = "supported: --host=ADDR --ports=P1,P2 --connections=N --depth=D --threads=T "
+                                "--duration=SECONDS --mix=/url=weight,... --output=FILE";
+  Options options;
+  for (int i = 1; i < argc; ++i) {
+    string_view arg = argv[i];
+    auto eq = arg.find('=');
+    auto name = arg.substr(0, eq);
+    string value{ eq == string_view::npos ? string_view{} : arg.substr(eq + 1) };
+    if (name == "--host")
+      options.host = value;
+    else if (name == "--ports")
+      options.ports = split(value, ',');
+    else if (name == "--connections")
+      options.connections = std::atoi(value.c_str());
+    else if (name == "--depth")
+      options.depth = std::atoi(value.c_str());
+    else if (name == "--threads")
+      options.threads = std::atoi(value.c_str());
+    else if (name == "--duration")
+      options.duration = std::atoi(value.c_str());
+    else if (name == "--mix")
+      options.mix = value;
+    else if (name == "--output")
+      options.output = value;
+    else
+      throw std::invalid_argument(fmt::format("unknown argument {}, {}", arg, usage));
+  }
+  if (options.connections <= 0 || options.depth <= 0 || options.threads <= 0 || options.duration <= 0 ||
+    options.ports.empty())
+    throw std::invalid_argument(fmt::format("connections, depth, threads, duration and ports must be positive, {}", usage));
+  options.threads = std::min(options.threads, options.connections);
+  return options;
+}
+
+// JSON string contents
+string json_escape(string_view text) {
+  string result;
+  for (char c : text) {
+    if (c == '"' || c == '\\')
+      result += {'\\', c};
+    else if (static_cast<unsigned char>(c) < 0x20)
+      result += fmt::format("\\u{:04x}", int(c));
+    else
+      result += c;
+  }
+  return result;
+}
+
+string to_json(const Options& options, const Stats& stats, double seconds) {
+  string statuses;
+  for (auto [status, count] : stats.statuses)
+    statuses += fmt::format("{}\"{}\": {}", statuses.empty() ? "" : ", ", status, count);
+  return fmt::format(
+    "{{\n"
+    "  \"connections\": {},\n"
+    "  \"depth\": {},\n"
+    "  \"threads\": {},\n"
+    "  \"mix\": \"{}\",\n"
+    "  \"seconds\": {:.3f},\n"
+    "  \"requests\": {},\n"
+    "  \"bytes\": {},\n"
+    "  \"requests_per_sec\": {:.1f},\n"
+    "  \"bytes_per_sec\": {:.1f},\n"
+    "  \"errors\": {},\n"
+    "  \"reconnects\": {},\n"
+    "  \"status\": {{{}}},\n"
+    "  \"latency_us\": {{\"p50\": {}, \"p90\": {}, \"p99\": {}, \"p999\": {}, \"max\": {}}}\n"
+    "}}\n",
+    options.connections, options.depth, options.threads, json_escape(options.mix), seconds, stats.requests, stats.bytes,
+    double(stats.requests) / seconds, double(stats.bytes) / seconds, stats.errors, stats.reconnects, statuses,
+    stats.latency.quantile(0.5), stats.latency.quantile(0.9), stats.latency.quantile(0.99),
+    stats.latency.quantile(0.999), stats.latency.max());
+}
+
+int main(int argc, char* argv[]) {
+  try {
+    auto options = parse_options(argc, argv);
+    auto mix = parse_mix(options.mix);
+
+    std::vector<asio::ip::tcp::endpoint> endpoints;
+    {
+      asio::io_context context;
+      for (auto& port : options.ports)
+        endpoints.push_back(asio::ip::tcp::resolver{ context }.resolve(options.host, port)->endpoint());
+    }
+
+    // every thread has its own io_context, connections and stats
+    std::atomic_bool stop = false;
+    std::atomic_int running = options.threads;
+    std::vector<Stats> stats(size_t(options.threads));
+    std::vector<std::unique_ptr<asio::io_context>> contexts;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < options.threads; ++t) {
+      auto& context = *contexts.emplace_back(std::make_unique<asio::io_context>(1));
+      threads.emplace_back([&, t] {
+        std::vector<std::unique_ptr<Connection>> connections;
+        for (int c = t; c < options.connections; c += options.threads) {
+          auto& endpoint = endpoints[size_t(c) % endpoints.size()];
+          connections.push_back(
+            std::make_unique<Connection>(context, options, mix, endpoint, stats[size_t(t)], stop, unsigned(c + 1)));
+          asio::co_spawn(context, [&connection = *connections.back()] { return connection.run(); }, asio::detached);
+        }
+        context.run();
+        --running;
+      });
+    }
+
+    // throughput is measured up to the stop, not over the wait for the connections to finish
+    auto start = clock_type::now();
+    std::this_thread::sleep_for(std::chrono::seconds(options.duration));
+    stop = true;
+    double seconds = std::chrono::duration<double>(clock_type::now() - start).count();
+    // connections finish their current exchange, unless the server doesn't answer
+    auto deadline = clock_type::now() + std::chrono::seconds(5);
+    while (running && clock_type::now() < deadline)
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    for (auto& context : contexts)
+      context->stop();
+    for (auto& th : threads)
+      th.join();
+
+    Stats total;
+    for (auto& item : stats)
+      total.merge(item);
+    fmt::print("{} connections, depth {}, {} threads, {:.1f} s\n", options.connections, options.depth, options.threads, seconds);
+    fmt::print("requests: {} ({:.1f}/s), bytes: {} ({:.1f} MB/s), errors: {}, reconnects: {}\n", total.requests,
+      double(total.requests) / seconds, total.bytes, double(total.bytes) / seconds / 1e6, total.errors, total.reconnects);
+    for (auto [status, count] : total.statuses)
+      fmt::print("status {}: {}\n", status, count);
+    fmt::print("latency us: p50 {}, p90 {}, p99 {}, p999 {}, max {}\n", total.latency.quantile(0.5),
+      total.latency.quantile(0.9), total.latency.quantile(0.99), total.latency.quantile(0.999), total.latency.max());
+
+    if (!options.output.empty()) {
+      std::FILE* file = std::fopen(options.output.c_str(), "w");
+      if (!file)
+        throw std::runtime_error(fmt::format("can't open {}", options.output));
+      auto json = to_json(options, total, seconds);
+      std::fwrite(json.data(), 1, json.size(), file);
+      std::fclose(file);
+    }
+  }
+  catch (std::exception& e) {
+    fmt::print(stderr, "error: {}\n", e.what());
+    return 1;
+  }
+}
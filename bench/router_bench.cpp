@@ -0,0 +1,69 @@
+// micro benchmark of Router::find: the lookup time should stay flat as routes are added
+#include "router.hpp"
+#include <fmt/format.h>
+#include <chrono>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using std::string;
+using std::string_view;
+using clock_type = std::chrono::steady_clock;
+
+// the default routes of the server plus extra literal paths and patterns, about a tenth of them patterns;
+// every route has its own name, so it gets its own metrics id as in a real table
+Router make_router(int route_count, std::vector<string>& paths) {
+  Router router;
+  RouteHandler handler = [](const RouteContext&, Response&) {};
+  router.add(HttpMethod::get, "/", "root", handler);
+  router.add(HttpMethod::get, "/many_photos", "gallery", handler);
+  router.add(HttpMethod::get, "/favicon.ico", "favicon", handler);
+  router.add(HttpMethod::get, "/photo{n}.jpg", "photo", handler);
+  router.add(HttpMethod::get, "/files/{name*}", "files", handler);
+  router.add(HttpMethod::get, "/metrics", "metrics", handler);
+  paths = { "/", "/many_photos", "/favicon.ico", "/photo17.jpg", "/files/docs/readme.txt", "/metrics", "/missing" };
+  for (int i = 6; i < route_count; ++i) {
+    if (i % 10 == 0) {
+      router.add(HttpMethod::get, fmt::format("/api/v{}/items/{{id}}/details", i), fmt::format("api_v{}", i), handler);
+      paths.push_back(fmt::format("/api/v{}/items/{}/details", i, i * 7));
+    }
+    else {
+      auto path = fmt::format("/section{}/page{}.html", i % 37, i);
+      router.add(HttpMethod::get, path, fmt::format("page{}", i), handler);
+      paths.push_back(path);
+    }
+  }
+  router.build();
+  return router;
+}
+
+int main(int argc, char* argv[]) {
+  constexpr int lookups = 2'000'000;
+  std::vector<int> route_counts = { 13, 101, 1001, 4001 };
+  if (argc > 1) {
+    route_counts.clear();
+    for (int i = 1; i < argc; ++i)
+      route_counts.push_back(std::atoi(argv[i]));
+  }
+  for (int route_count : route_counts) {
+    std::vector<string> paths;
+    auto router = make_router(route_count, paths);
+    // paths are visited in a random order so the branch predictor can't learn one; the order is
+    // short enough to stay in the cache, which measures the lookup rather than memory misses
+    std::minstd_rand random(1);
+    std::vector<string_view> order(4096);
+    for (auto& path : order)
+      path = paths[std::uniform_int_distribution<size_t>(0, paths.size() - 1)(random)];
+
+    size_t found = 0;
+    auto start = clock_type::now();
+    for (int i = 0; i < lookups; ++i) {
+      RouteParams params;
+      found += router.find(HttpMethod::get, order[size_t(i) % order.size()], params).handler != nullptr;
+    }
+    auto ns = std::chrono::duration<double, std::nano>(clock_type::now() - start).count() / lookups;
+    fmt::print("{} routes: {:.1f} ns per lookup ({} of {} found)\n", route_count, ns, found, lookups);
+  }
+}
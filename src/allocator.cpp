@@ -0,0 +1,48 @@
+#include "allocator.hpp"
+#include <cstdlib>
+
+#ifndef NDEBUG
+
+namespace {
+thread_local uint64_t heap_allocations = 0;
+}  // namespace
+
+// replaced to count allocations, the other forms of new and delete end up here
+void* operator new(std::size_t size) {
+  ++heap_allocations;
+  if (void* pointer = std::malloc(size ? size : 1))
+    return pointer;
+  throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size) {
+  return ::operator new(size);
+}
+
+void operator delete(void* pointer) noexcept {
+  std::free(pointer);
+}
+
+void operator delete[](void* pointer) noexcept {
+  std::free(pointer);
+}
+
+void operator delete(void* pointer, std::size_t) noexcept {
+  std::free(pointer);
+}
+
+void operator delete[](void* pointer, std::size_t) noexcept {
+  std::free(pointer);
+}
+
+uint64_t heap_allocation_count() {
+  return heap_allocations;
+}
+
+#else
+
+uint64_t heap_allocation_count() {
+  return 0;
+}
+
+#endif
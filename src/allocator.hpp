@@ -0,0 +1,107 @@
+#pragma once
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <utility>
+
+namespace detail {
+
+// free lists of recycled blocks in power-of-two size classes from 64 bytes to 64 KiB;
+// each class keeps up to max_cached_bytes, larger blocks and the excess go back to the heap
+class BlockPool
+{
+public:
+  static constexpr size_t min_block = 64;
+  static constexpr size_t max_block = 64 * 1024;
+  static constexpr size_t max_cached_bytes = 1024 * 1024;
+
+  BlockPool() = default;
+  BlockPool(const BlockPool&) = delete;
+  BlockPool& operator=(const BlockPool&) = delete;
+  ~BlockPool() {
+    for (auto block : free)
+      while (block)
+        ::operator delete(std::exchange(block, block->next));
+  }
+
+  void* allocate(size_t size) {
+    if (size > max_block)
+      return ::operator new(size);
+    auto index = class_index(size);
+    if (auto block = free[index]) {
+      free[index] = block->next;
+      --count[index];
+      return block;
+    }
+    return ::operator new(min_block << index);
+  }
+
+  void deallocate(void* pointer, size_t size) noexcept {
+    auto index = class_index(size);
+    if (size > max_block || (count[index] + 1) * (min_block << index) > max_cached_bytes) {
+      ::operator delete(pointer);
+      return;
+    }
+    free[index] = new (pointer) FreeBlock{ free[index] };
+    ++count[index];
+  }
+
+private:
+  struct FreeBlock {
+    FreeBlock* next;
+  };
+  static constexpr size_t class_count = std::bit_width(max_block / min_block);
+
+  static size_t class_index(size_t size) {
+    return size <= min_block ? 0 : std::bit_width((size - 1) / min_block);
+  }
+
+  std::array<FreeBlock*, class_count> free{};
+  std::array<size_t, class_count> count{};
+};
+
+inline thread_local BlockPool block_pool;
+
+}  // namespace detail
+
+// memory of connection state - coroutine frames, asio operations, read buffers - is recycled
+// through a pool of the current thread instead of the heap; a block may be freed on another
+// thread than it was allocated on (shared mode), it joins the pool of that thread then
+inline void* pool_allocate(size_t size) {
+  return detail::block_pool.allocate(size);
+}
+
+inline void pool_deallocate(void* pointer, size_t size) noexcept {
+  detail::block_pool.deallocate(pointer, size);
+}
+
+// standard allocator on top of the pool of the current thread
+template <class T>
+class PoolAllocator
+{
+public:
+  using value_type = T;
+
+  PoolAllocator() noexcept = default;
+  template <class U>
+  PoolAllocator(const PoolAllocator<U>&) noexcept {
+  }
+
+  T* allocate(size_t n) {
+    return static_cast<T*>(pool_allocate(n * sizeof(T)));
+  }
+  void deallocate(T* pointer, size_t n) noexcept {
+    pool_deallocate(pointer, n * sizeof(T));
+  }
+
+  template <class U>
+  bool operator==(const PoolAllocator<U>&) const noexcept {
+    return true;
+  }
+};
+
+// calls of the global operator new made by the current thread; counted in debug builds
+// (the server replaces operator new then), always 0 in release builds
+uint64_t heap_allocation_count();
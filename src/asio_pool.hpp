@@ -0,0 +1,113 @@
+#pragma once
+#include "allocator.hpp"
+#include <asio.hpp>
+#include <type_traits>
+#include <utility>
+
+// asio state of connections taken from the per-thread pool (allocator.hpp)
+
+// coroutine frames: asio recycles a single frame per thread, which doesn't help once many
+// connections await nested coroutines; must be visible before coroutines are defined
+template <>
+inline void* asio::detail::awaitable_frame_base<asio::executor>::operator new(std::size_t size) {
+  return pool_allocate(size);
+}
+
+template <>
+inline void asio::detail::awaitable_frame_base<asio::executor>::operator delete(void* pointer, std::size_t size) {
+  pool_deallocate(pointer, size);
+}
+
+// completion token adapter: state of operations started with pooled(token) is allocated
+// from the pool of the current thread, through asio's handler allocation hooks (socket
+// operations) and the associated allocator (posted and dispatched functions)
+template <class Token>
+struct Pooled {
+  Token token;
+};
+
+template <class Token>
+Pooled<std::decay_t<Token>> pooled(Token&& token) {
+  return { std::forward<Token>(token) };
+}
+
+template <class Handler>
+class PooledHandler
+{
+public:
+  using allocator_type = PoolAllocator<void>;
+
+  explicit PooledHandler(Handler&& handler) : handler(std::move(handler)) {
+  }
+
+  template <class... Args>
+  void operator()(Args&&... args) {
+    handler(std::forward<Args>(args)...);
+  }
+
+  allocator_type get_allocator() const noexcept {
+    return {};
+  }
+
+  friend void* asio_handler_allocate(size_t size, PooledHandler*) {
+    return pool_allocate(size);
+  }
+
+  friend void asio_handler_deallocate(void* pointer, size_t size, PooledHandler*) {
+    pool_deallocate(pointer, size);
+  }
+
+  friend bool asio_handler_is_continuation(PooledHandler* self) {
+    return asio_handler_cont_helpers::is_continuation(self->handler);
+  }
+
+  template <class Function>
+  friend void asio_handler_invoke(Function& function, PooledHandler* self) {
+    asio_handler_invoke_helpers::invoke(function, self->handler);
+  }
+
+  template <class Function>
+  friend void asio_handler_invoke(const Function& function, PooledHandler* self) {
+    asio_handler_invoke_helpers::invoke(function, self->handler);
+  }
+
+  Handler handler;
+};
+
+namespace asio {
+
+template <class Token, class Signature>
+class async_result<Pooled<Token>, Signature>
+{
+public:
+  using return_type = typename async_result<Token, Signature>::return_type;
+
+  template <class Initiation>
+  struct InitWrapper {
+    template <class Handler, class... Args>
+    void operator()(Handler&& handler, Args&&... args) {
+      std::move(initiation)(
+        PooledHandler<std::decay_t<Handler>>{ std::forward<Handler>(handler) }, std::forward<Args>(args)...);
+    }
+
+    Initiation initiation;
+  };
+
+  template <class Initiation, class RawToken, class... Args>
+  static return_type initiate(Initiation&& initiation, RawToken&& token, Args&&... args) {
+    return async_initiate<Token, Signature>(
+      InitWrapper<std::decay_t<Initiation>>{ std::forward<Initiation>(initiation) }, token.token,
+      std::forward<Args>(args)...);
+  }
+};
+
+template <class Handler, class Executor>
+struct associated_executor<PooledHandler<Handler>, Executor> {
+  using type = typename associated_executor<Handler, Executor>::type;
+
+  static type get(const PooledHandler<Handler>& handler, const Executor& executor = Executor()) noexcept {
+    return associated_executor<Handler, Executor>::get(handler.handler, executor);
+  }
+};
+
+}  // namespace asio
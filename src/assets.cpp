@@ -0,0 +1,110 @@
+#include "assets.hpp"
+#include "cache_policy.hpp"
+#include "compress.hpp"
+#include "http_date.hpp"
+#include <fmt/format.h>
+#include <array>
+#include <stdexcept>
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+namespace {
+
+#ifdef _WIN32
+
+// resources are mapped together with the module image, so no copy is needed
+std::string_view from_resource(int id) {
+  HMODULE hModule = NULL;
+  GetModuleHandleEx(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS, (LPCTSTR)&from_resource, &hModule);
+  if (HRSRC fr = FindResourceA(hModule, MAKEINTRESOURCEA(id), "DAT")) {
+    auto rsize = SizeofResource(hModule, fr);
+    if (auto res = LoadResource(hModule, fr))
+      if (const char* resource = (const char*)LockResource(res))
+        return { resource, rsize };
+  }
+  return {};
+}
+
+#else
+
+// places file contents into .rodata of this object file, see ASSETS_DIR in CMakeLists.txt
+#define EMBED_FILE(name, file) \
+  __asm__( \
+    ".section .rodata\n" \
+    ".global " #name "_begin\n" \
+    ".balign 16\n" #name "_begin:\n" \
+    ".incbin \"" ASSETS_DIR "/" file "\"\n" \
+    ".global " #name "_end\n" #name "_end:\n" \
+    ".previous\n"); \
+  extern "C" const char name##_begin[]; \
+  extern "C" const char name##_end[];
+
+EMBED_FILE(experiments_asset_favicon, "main.ico")
+EMBED_FILE(experiments_asset_photo, "photo.jpg")
+
+#endif
+
+std::array<Asset, size_t(AssetId::count)> assets;
+
+void make_variant(AssetVariant& variant, const Asset& asset, std::string_view fields) {
+  std::array<char, http_date_size + 1> last_modified;
+  if (!format_http_date(asset.last_modified, last_modified.data()))
+    throw std::runtime_error("can't format asset modification time");
+  auto validators = fmt::format("{}{}ETag:{}\r\nLast-Modified:{}\r\n", cache_control_field(CacheClass::assets),
+    asset.has_gzip() ? "Vary:Accept-Encoding\r\n" : "", variant.etag, last_modified.data());
+  variant.header = fmt::format(
+    "HTTP/1.1 200 OK\r\n"
+    "Content-Length:{}\r\n"
+    "Content-Type:{}\r\n"
+    "{}{}",
+    variant.body.size(), asset.content_type, fields, validators);
+  variant.not_modified_header = "HTTP/1.1 304 Not Modified\r\n" + validators;
+}
+
+void make_asset(Asset& asset, std::string_view content_type, std::string_view body, std::time_t modified) {
+  // gzip variant is kept only if it saves at least this share of the size
+  constexpr size_t min_saving_percent = 10;
+  if (body.empty())
+    throw std::runtime_error(fmt::format("embedded asset of type {} is missing", content_type));
+  asset.content_type = content_type;
+  asset.last_modified = modified;
+  asset.identity.body = body;
+  asset.identity.etag = content_etag(body);
+  if (gzip_supported()) {
+    asset.gzip_body = gzip(body);
+    if (asset.gzip_body.size() * 100 <= body.size() * (100 - min_saving_percent)) {
+      asset.gzip.body = asset.gzip_body;
+      // same validator with a suffix, a strong ETag must differ between content codings
+      auto& etag = asset.identity.etag;
+      asset.gzip.etag = etag.substr(0, etag.size() - 1) + "-gzip\"";
+    }
+    else
+      asset.gzip_body.clear();
+  }
+  make_variant(asset.identity, asset, {});
+  if (asset.has_gzip())
+    make_variant(asset.gzip, asset, "Content-Encoding:gzip\r\n");
+}
+
+}  // namespace
+
+void load_assets() {
+#ifdef _WIN32
+  auto favicon = from_resource(101);
+  auto photo = from_resource(102);
+#else
+  std::string_view favicon{ experiments_asset_favicon_begin,
+    size_t(experiments_asset_favicon_end - experiments_asset_favicon_begin) };
+  std::string_view photo{ experiments_asset_photo_begin,
+    size_t(experiments_asset_photo_end - experiments_asset_photo_begin) };
+#endif
+  // set by the build, the same in every run of a binary
+  std::time_t modified = ASSETS_MODIFIED;
+  make_asset(assets[size_t(AssetId::favicon)], "image/x-icon", favicon, modified);
+  make_asset(assets[size_t(AssetId::photo)], "image/jpeg", photo, modified);
+}
+
+const Asset& get_asset(AssetId id) {
+  return assets[size_t(id)];
+}
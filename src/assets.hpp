@@ -0,0 +1,33 @@
+#pragma once
+#include <ctime>
+#include <string>
+#include <string_view>
+
+enum class AssetId { favicon, photo, count };
+
+// one representation (content coding) of an asset
+struct AssetVariant {
+  std::string_view body;            // valid for the whole program lifetime
+  std::string header;               // precomputed status line and fields, except Date
+  std::string etag;                 // strong validator, differs between variants
+  std::string not_modified_header;  // precomputed 304 response, except Date
+};
+
+// static file served straight from memory, never modified after load_assets()
+struct Asset {
+  std::string_view content_type;
+  std::time_t last_modified = 0;  // modification time of the asset files at build time
+  AssetVariant identity;          // embedded data
+  AssetVariant gzip;              // empty body if compression doesn't pay off for the asset
+  std::string gzip_body;          // storage of gzip.body
+
+  bool has_gzip() const {
+    return !gzip.body.empty();
+  }
+};
+
+// resolves all embedded assets, compresses them, computes their validators and precomputes
+// 200 and 304 headers; call once before serving, after the Cache-Control configuration (parse_max_age)
+void load_assets();
+
+const Asset& get_asset(AssetId id);
@@ -0,0 +1,77 @@
+#include "cache_policy.hpp"
+#include "header_values.hpp"
+#include "http_date.hpp"
+#include "request.hpp"
+#include <fmt/format.h>
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cstdint>
+
+namespace {
+
+constexpr std::string_view class_names[] = { "assets", "files", "pages" };
+
+// assets rarely change, files may be edited in place, pages show the current time
+std::array<std::string, size_t(CacheClass::count)> cache_control = { "Cache-Control:public, max-age=86400\r\n",
+  "Cache-Control:public, max-age=3600\r\n", "Cache-Control:no-cache\r\n" };
+
+// weak comparison (RFC 7232 2.3.2), as required for If-None-Match
+bool etag_listed(std::string_view list, std::string_view etag) {
+  if (trim(list) == "*")
+    return true;
+  for (std::string_view item; next_item(list, item);)
+    if ((item.starts_with("W/") ? item.substr(2) : item) == etag)
+      return true;
+  return false;
+}
+
+}  // namespace
+
+bool parse_max_age(std::string_view spec) {
+  while (!spec.empty()) {
+    auto item = spec.substr(0, spec.find(','));
+    spec.remove_prefix(std::min(spec.size(), item.size() + 1));
+    auto colon = item.find(':');
+    if (colon == std::string_view::npos)
+      return false;
+    auto name = item.substr(0, colon);
+    auto value = item.substr(colon + 1);
+    unsigned seconds = 0;
+    auto [end, ec] = std::from_chars(value.data(), value.data() + value.size(), seconds);
+    if (ec != std::errc{} || end != value.data() + value.size())
+      return false;
+    size_t index = 0;
+    while (index < std::size(class_names) && class_names[index] != name)
+      ++index;
+    if (index == std::size(class_names))
+      return false;
+    cache_control[index] =
+      seconds ? fmt::format("Cache-Control:public, max-age={}\r\n", seconds) : "Cache-Control:no-cache\r\n";
+  }
+  return true;
+}
+
+std::string_view cache_control_field(CacheClass cache_class) {
+  return cache_control[size_t(cache_class)];
+}
+
+std::string content_etag(std::string_view content) {
+  // FNV-1a, computed once per asset at load time
+  uint64_t hash = 14695981039346656037ull;
+  for (unsigned char c : content) {
+    hash ^= c;
+    hash *= 1099511628211ull;
+  }
+  return fmt::format("\"{:016x}-{:x}\"", hash, content.size());
+}
+
+bool is_not_modified(const Request& request, std::string_view etag, std::time_t last_modified) {
+  if (auto if_none_match = request.header("If-None-Match"); !if_none_match.empty())
+    return etag_listed(if_none_match, etag);
+  if (auto if_modified_since = request.header("If-Modified-Since"); !if_modified_since.empty()) {
+    auto since = parse_http_date(if_modified_since);
+    return since >= 0 && last_modified <= since;
+  }
+  return false;
+}
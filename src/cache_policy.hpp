@@ -0,0 +1,24 @@
+#pragma once
+#include <ctime>
+#include <string>
+#include <string_view>
+
+struct Request;
+
+// route classes with their own Cache-Control max-age
+enum class CacheClass { assets, files, pages, count };
+
+// configures max-age from "class:seconds,..." (e.g. "assets:86400,files:0"), classes are
+// assets, files and pages; returns false if the spec is invalid. Call before load_assets(),
+// asset headers are precomputed with the configured value
+bool parse_max_age(std::string_view spec);
+
+// "Cache-Control:public, max-age=N\r\n", or "Cache-Control:no-cache\r\n" when max-age is 0
+std::string_view cache_control_field(CacheClass cache_class);
+
+// strong validator built from the content, e.g. "\"5f3b2a...\""
+std::string content_etag(std::string_view content);
+
+// true if the conditional headers of the request show that the client's copy is current,
+// so the response is 304 Not Modified; If-None-Match takes precedence over If-Modified-Since
+bool is_not_modified(const Request& request, std::string_view etag, std::time_t last_modified);
@@ -0,0 +1,163 @@
+#include "compress.hpp"
+#include "header_values.hpp"
+#include <stdexcept>
+#ifdef HAS_ZLIB
+#include <zlib.h>
+#endif
+
+namespace {
+
+#ifdef HAS_ZLIB
+
+// gzip member header: deflate, no flags, no mtime, unknown OS
+constexpr std::string_view gzip_header{ "\x1f\x8b\x08\x00\x00\x00\x00\x00\x00\xff", 10 };
+// empty final block with fixed codes, closes a stream made of full-flushed pieces
+constexpr std::string_view final_block{ "\x03\x00", 2 };
+
+void append_le32(std::vector<char>& out, uint32_t value) {
+  for (int i = 0; i < 4; ++i)
+    out.push_back(char((value >> (8 * i)) & 0xff));
+}
+
+// raw deflate stream (no zlib/gzip wrapper)
+class Deflater
+{
+public:
+  explicit Deflater(int level) {
+    if (deflateInit2(&stream, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+      throw std::runtime_error("deflateInit2 failed");
+  }
+  Deflater(const Deflater&) = delete;
+  Deflater& operator=(const Deflater&) = delete;
+  ~Deflater() {
+    deflateEnd(&stream);
+  }
+
+  // appends compressed text to out, ending with flush (Z_FULL_FLUSH or Z_FINISH)
+  template <class Buffer>
+  void compress(std::string_view text, Buffer& out, int flush) {
+    deflateReset(&stream);
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(text.data()));
+    stream.avail_in = uInt(text.size());
+    size_t used = out.size();
+    // deflateBound is for Z_FINISH, a full flush adds an empty stored block
+    out.resize(used + deflateBound(&stream, uLong(text.size())) + 16);
+    while (true) {
+      stream.next_out = reinterpret_cast<Bytef*>(out.data() + used);
+      stream.avail_out = uInt(out.size() - used);
+      int res = deflate(&stream, flush);
+      used = out.size() - stream.avail_out;
+      if (res == Z_STREAM_ERROR)
+        throw std::runtime_error("deflate failed");
+      if (stream.avail_out != 0 || res == Z_STREAM_END)
+        break;
+      out.resize(out.size() * 2);
+    }
+    out.resize(used);
+  }
+
+private:
+  z_stream stream{};
+};
+
+Deflater& thread_deflater() {
+  static thread_local Deflater deflater{ Z_DEFAULT_COMPRESSION };
+  return deflater;
+}
+
+#endif
+
+}  // namespace
+
+bool gzip_supported() {
+#ifdef HAS_ZLIB
+  return true;
+#else
+  return false;
+#endif
+}
+
+Encoding negotiate_encoding(std::string_view accept_encoding) {
+  if (!gzip_supported())
+    return Encoding::identity;
+  // "gzip", "gzip;q=0.5", "*" are accepted, "gzip;q=0" is not; an explicit gzip item
+  // takes precedence over "*" wherever it is in the list
+  enum class Listed { no, accepted, rejected };
+  Listed gzip = Listed::no, any = Listed::no;
+  for (std::string_view item; next_item(accept_encoding, item);) {
+    auto semicolon = item.find(';');
+    auto coding = trim(item.substr(0, semicolon));
+    if (iequals(coding, "gzip") || coding == "*") {
+      auto params = semicolon == std::string_view::npos ? std::string_view{} : trim(item.substr(semicolon + 1));
+      bool rejected = params.size() >= 3 && (params[0] | 0x20) == 'q' && params[1] == '=' &&
+        params.find_first_not_of("0.", 2) == std::string_view::npos;
+      (coding == "*" ? any : gzip) = rejected ? Listed::rejected : Listed::accepted;
+    }
+  }
+  auto listed = gzip != Listed::no ? gzip : any;
+  return listed == Listed::accepted ? Encoding::gzip : Encoding::identity;
+}
+
+std::string gzip(std::string_view data) {
+#ifdef HAS_ZLIB
+  std::vector<char> out(gzip_header.begin(), gzip_header.end());
+  Deflater deflater{ Z_BEST_COMPRESSION };
+  deflater.compress(data, out, Z_FINISH);
+  append_le32(out, uint32_t(crc32(0, reinterpret_cast<const Bytef*>(data.data()), uInt(data.size()))));
+  append_le32(out, uint32_t(data.size()));
+  return { out.begin(), out.end() };
+#else
+  return {};
+#endif
+}
+
+CompressedSegment compress_segment(std::string_view text) {
+  CompressedSegment segment;
+#ifdef HAS_ZLIB
+  Deflater deflater{ Z_BEST_COMPRESSION };
+  deflater.compress(text, segment.data, Z_FULL_FLUSH);
+  segment.crc = uint32_t(crc32(0, reinterpret_cast<const Bytef*>(text.data()), uInt(text.size())));
+  segment.size = text.size();
+#endif
+  return segment;
+}
+
+GzipWriter::GzipWriter(std::vector<char>& out) : out(out) {
+#ifdef HAS_ZLIB
+  out.insert(out.end(), gzip_header.begin(), gzip_header.end());
+  crc = uint32_t(crc32(0, nullptr, 0));
+#endif
+}
+
+void GzipWriter::append(const CompressedSegment& segment) {
+#ifdef HAS_ZLIB
+  out.insert(out.end(), segment.data.begin(), segment.data.end());
+  crc = uint32_t(crc32_combine(crc, segment.crc, z_off_t(segment.size)));
+  size += segment.size;
+#endif
+}
+
+void GzipWriter::compress(std::string_view text) {
+#ifdef HAS_ZLIB
+  if (text.empty())
+    return;
+  // history is reset for every piece: the decompressor window also contains the spliced
+  // static segments, so back-references across pieces would point to the wrong data
+  thread_deflater().compress(text, out, Z_FULL_FLUSH);
+  crc = uint32_t(crc32(crc, reinterpret_cast<const Bytef*>(text.data()), uInt(text.size())));
+  size += text.size();
+#endif
+}
+
+void GzipWriter::finish() {
+#ifdef HAS_ZLIB
+  out.insert(out.end(), final_block.begin(), final_block.end());
+  append_le32(out, crc);
+  append_le32(out, uint32_t(size));
+#endif
+}
+
+std::vector<char>& GzipWriter::scratch() {
+  static thread_local std::vector<char> buffer;
+  return buffer;
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+enum class Encoding { identity, gzip };
+
+// false when built without zlib; everything is then sent as identity
+bool gzip_supported();
+
+// picks the encoding of the response from the Accept-Encoding value of the request
+Encoding negotiate_encoding(std::string_view accept_encoding);
+
+// whole gzip stream of data, for content compressed once at startup
+std::string gzip(std::string_view data);
+
+// raw deflate data of a static text, compressed once with a full flush: it ends on a byte
+// boundary and doesn't refer to preceding data, so it can be spliced into any gzip stream
+struct CompressedSegment {
+  std::string data;
+  uint32_t crc = 0;  // CRC-32 of the uncompressed text
+  size_t size = 0;   // uncompressed size
+};
+
+CompressedSegment compress_segment(std::string_view text);
+
+// builds a gzip stream in out from precompressed segments and text compressed on the fly;
+// dynamic text goes through a deflate context kept per thread, so there is no setup per response
+class GzipWriter
+{
+public:
+  explicit GzipWriter(std::vector<char>& out);
+
+  void append(const CompressedSegment& segment);
+  void compress(std::string_view text);
+  // writes the final block and the trailer
+  void finish();
+
+  // buffer of the current thread for rendering dynamic text before compressing it
+  static std::vector<char>& scratch();
+
+private:
+  std::vector<char>& out;
+  uint32_t crc = 0;
+  size_t size = 0;
+};
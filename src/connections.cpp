@@ -0,0 +1,78 @@
+#include "connections.hpp"
+#include "timer_wheel.hpp"
+
+namespace {
+
+ConnectionTimeouts timeouts;
+int max_connections = 0;
+int max_context_connections = 0;
+std::atomic<int> open_connections{ 0 };
+
+// 0 means unlimited
+bool reached(const std::atomic<int>& count, int max) {
+  return max > 0 && count.load(std::memory_order_relaxed) >= max;
+}
+
+}  // namespace
+
+void set_connection_timeouts(const ConnectionTimeouts& value) {
+  timeouts = value;
+}
+
+const ConnectionTimeouts& connection_timeouts() {
+  return timeouts;
+}
+
+void set_connection_limits(int global_max, int context_max) {
+  max_connections = global_max;
+  max_context_connections = context_max;
+}
+
+bool connection_limits_set() {
+  return max_connections > 0 || max_context_connections > 0;
+}
+
+int open_connection_count() {
+  return open_connections.load(std::memory_order_relaxed);
+}
+
+ConnectionSlot::~ConnectionSlot() {
+  if (owner)
+    owner->release();
+}
+
+asio::io_context::id ConnectionSlots::id;
+
+ConnectionSlots::ConnectionSlots(asio::io_context& context) : asio::io_context::service(context), context(context) {
+}
+
+bool ConnectionSlots::full() const {
+  return draining() || reached(open, max_context_connections) || reached(open_connections, max_connections);
+}
+
+ConnectionSlot ConnectionSlots::open_connection() {
+  open.fetch_add(1, std::memory_order_relaxed);
+  open_connections.fetch_add(1, std::memory_order_relaxed);
+  return ConnectionSlot{ *this };
+}
+
+void ConnectionSlots::release() {
+  open.fetch_sub(1, std::memory_order_relaxed);
+  open_connections.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void ConnectionSlots::add_acceptor(std::function<void()> cancel) {
+  std::lock_guard locker(mx);
+  acceptors.push_back(std::move(cancel));
+}
+
+void ConnectionSlots::drain() {
+  draining_.store(true, std::memory_order_relaxed);
+  {
+    std::lock_guard locker(mx);
+    for (auto& cancel : acceptors)
+      cancel();
+    acceptors.clear();
+  }
+  asio::use_service<TimerWheel>(context).drain();
+}
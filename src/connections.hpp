@@ -0,0 +1,85 @@
+#pragma once
+#include <asio.hpp>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+// per-connection timeouts, 0 disables one
+struct ConnectionTimeouts {
+  // from the first byte of a request to its end, body included; also from the connect of a
+  // connection to its first byte
+  std::chrono::seconds header{ 10 };
+  std::chrono::seconds idle{ 60 };   // keep-alive connection waiting for the next request
+  std::chrono::seconds write{ 30 };  // one write or sendfile wait of a response
+};
+
+void set_connection_timeouts(const ConnectionTimeouts& timeouts);
+const ConnectionTimeouts& connection_timeouts();
+
+// connections open at once in the process and per io_context, 0 means unlimited;
+// call before the servers start
+void set_connection_limits(int global_max, int context_max);
+bool connection_limits_set();
+
+// connections open in the process
+int open_connection_count();
+
+class ConnectionSlots;
+
+// reservation of a connection, released on destruction
+class ConnectionSlot
+{
+public:
+  ConnectionSlot() = default;
+  explicit ConnectionSlot(ConnectionSlots& owner) : owner(&owner) {
+  }
+  ConnectionSlot(ConnectionSlot&& other) noexcept : owner(std::exchange(other.owner, nullptr)) {
+  }
+  ConnectionSlot& operator=(ConnectionSlot&&) = delete;
+  ~ConnectionSlot();
+
+  explicit operator bool() const {
+    return owner != nullptr;
+  }
+
+private:
+  ConnectionSlots* owner = nullptr;
+};
+
+// connection count of an io_context against the limits; acceptors wait for a free slot before
+// accepting, so accepting pauses while the limits are reached and the kernel keeps new connections
+// in the listen backlog. A slot is only taken once a connection is accepted, so an acceptor idling
+// on a quiet port doesn't hold one; acceptors racing for the last slot can overshoot a limit by one
+// connection each. Draining stops the acceptors and closes idle connections
+class ConnectionSlots : public asio::io_context::service
+{
+public:
+  static asio::io_context::id id;
+
+  explicit ConnectionSlots(asio::io_context& context);
+
+  // a limit is reached or the io_context drains
+  bool full() const;
+  ConnectionSlot open_connection();
+  void release();
+
+  // cancel is called to stop the accept loop when draining
+  void add_acceptor(std::function<void()> cancel);
+  void drain();
+  bool draining() const {
+    return draining_.load(std::memory_order_relaxed);
+  }
+
+private:
+  void shutdown() override {
+  }
+
+  asio::io_context& context;
+  std::atomic<int> open{ 0 };
+  std::atomic<bool> draining_{ false };
+  std::mutex mx;
+  std::vector<std::function<void()>> acceptors;
+};
@@ -0,0 +1,40 @@
+#pragma once
+#include <algorithm>
+#include <string_view>
+
+// tokens of header values compare case insensitively (RFC 9110 5.6.2); only meant for ASCII tokens
+inline bool iequals(std::string_view a, std::string_view b) {
+  return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+    return (x | 0x20) == (y | 0x20);
+  });
+}
+
+// strips optional whitespace (spaces and tabs) around a value
+inline std::string_view trim(std::string_view text) {
+  while (!text.empty() && (text.front() == ' ' || text.front() == '\t'))
+    text.remove_prefix(1);
+  while (!text.empty() && (text.back() == ' ' || text.back() == '\t'))
+    text.remove_suffix(1);
+  return text;
+}
+
+// takes the next item of a comma separated list (RFC 9110 5.6.1) off the front of list, trimmed;
+// empty items are skipped, returns false at the end: for (std::string_view item; next_item(list, item);)
+inline bool next_item(std::string_view& list, std::string_view& item) {
+  while (!list.empty()) {
+    auto comma = list.find(',');
+    item = trim(list.substr(0, comma));
+    list.remove_prefix(comma == std::string_view::npos ? list.size() : comma + 1);
+    if (!item.empty())
+      return true;
+  }
+  return false;
+}
+
+// checks whether a comma separated list contains token (case insensitive)
+inline bool has_token(std::string_view list, std::string_view token) {
+  for (std::string_view item; next_item(list, item);)
+    if (iequals(item, token))
+      return true;
+  return false;
+}
@@ -0,0 +1,84 @@
+#pragma once
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+
+// log-linear histogram of non-negative values (e.g. latency in microseconds):
+// every power of two is split into 16 buckets, so the relative error is below 6.25%
+class Histogram
+{
+public:
+  void add(uint64_t value) {
+    ++counts[bucket_index(value)];
+    ++total;
+    if (value > max_value)
+      max_value = value;
+  }
+
+  void merge(const Histogram& other) {
+    for (size_t i = 0; i < counts.size(); ++i)
+      counts[i] += other.counts[i];
+    total += other.total;
+    if (other.max_value > max_value)
+      max_value = other.max_value;
+  }
+
+  uint64_t count() const {
+    return total;
+  }
+
+  uint64_t max() const {
+    return max_value;
+  }
+
+  // upper bound of the bucket containing the given quantile (0..1), 0 if empty
+  uint64_t quantile(double q) const {
+    uint64_t rank = uint64_t(q * double(total));
+    if (rank >= total)
+      rank = total ? total - 1 : 0;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < counts.size(); ++i) {
+      seen += counts[i];
+      if (seen > rank)
+        return upper_bound(i) < max_value ? upper_bound(i) : max_value;
+    }
+    return 0;
+  }
+
+  // bucket access, for exporting the distribution or merging counts collected elsewhere
+  static constexpr size_t bucket_count() {
+    return buckets;
+  }
+  uint64_t bucket(size_t i) const {
+    return counts[i];
+  }
+  void add_bucket(size_t i, uint64_t count) {
+    counts[i] += count;
+    total += count;
+    if (count && upper_bound(i) > max_value)
+      max_value = upper_bound(i);
+  }
+  static size_t bucket_index(uint64_t value) {
+    if (value < sub_buckets)
+      return size_t(value);
+    unsigned shift = unsigned(63 - std::countl_zero(value)) - sub_bits;
+    return (shift + 1) * sub_buckets + size_t((value >> shift) - sub_buckets);
+  }
+  static uint64_t upper_bound(size_t i) {
+    if (i < sub_buckets)
+      return i;
+    auto shift = i / sub_buckets - 1;
+    auto mantissa = i % sub_buckets + sub_buckets;
+    return ((mantissa + 1) << shift) - 1;
+  }
+
+private:
+  static constexpr unsigned sub_bits = 4;
+  static constexpr size_t sub_buckets = size_t(1) << sub_bits;
+  static constexpr size_t buckets = (64 - sub_bits + 1) * sub_buckets;
+
+  std::array<uint64_t, buckets> counts{};
+  uint64_t total = 0;
+  uint64_t max_value = 0;
+};
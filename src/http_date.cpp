@@ -0,0 +1,97 @@
+#include "http_date.hpp"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <string_view>
+
+namespace {
+
+// seqlock: sequence is odd while the updater rewrites the field, a reader retries if it changed
+// during its copy. The field is kept in relaxed atomic words so that a torn read isn't a data race
+constexpr size_t field_words = (date_field_size + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+std::array<std::atomic<uint64_t>, field_words> field_data;
+std::atomic<unsigned> sequence{ 0 };
+
+}  // namespace
+
+bool format_http_date(std::time_t time, char* out) {
+  struct tm ptmTemp;
+#ifdef _WIN32
+  bool failed = _gmtime64_s(&ptmTemp, &time) != 0;
+#else
+  bool failed = !gmtime_r(&time, &ptmTemp);
+#endif
+  return !failed && strftime(out, http_date_size + 1, "%a, %d %b %Y %T GMT", &ptmTemp) == http_date_size;
+}
+
+std::time_t parse_http_date(std::string_view text) {
+  // "Sun, 06 Nov 1994 08:49:37 GMT"
+  constexpr std::string_view months = "JanFebMarAprMayJunJulAugSepOctNovDec";
+  if (text.size() != http_date_size || text.substr(3, 2) != ", " || !text.ends_with(" GMT"))
+    return -1;
+  auto number = [text](size_t pos, size_t size) {
+    int value = 0;
+    for (auto c : text.substr(pos, size)) {
+      if (c < '0' || c > '9')
+        return -1;
+      value = value * 10 + (c - '0');
+    }
+    return value;
+  };
+  auto month_pos = months.find(text.substr(8, 3));
+  int day = number(5, 2), year = number(12, 4), hour = number(17, 2), minute = number(20, 2), second = number(23, 2);
+  if (month_pos == months.npos || month_pos % 3 || day < 1 || day > 31 || year < 1970 || hour > 23 || minute > 59 ||
+    second > 60 || text[16] != ' ' || text[19] != ':' || text[22] != ':')
+    return -1;
+
+  // days since 1970-01-01 of the civil date, see http://howardhinnant.github.io/date_algorithms.html
+  int month = int(month_pos / 3) + 1;
+  int y = year - (month <= 2);
+  int era = y / 400;
+  int yoe = y - era * 400;
+  int doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+  int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  std::time_t days = std::time_t(era) * 146097 + doe - 719468;
+  return days * 86400 + hour * 3600 + minute * 60 + second;
+}
+
+void update_http_date() {
+  using namespace std::chrono;
+  constexpr std::string_view prefix = "Date:";
+  std::array<char, field_words * sizeof(uint64_t)> field{};
+  std::memcpy(field.data(), prefix.data(), prefix.size());
+  if (!format_http_date(system_clock::to_time_t(system_clock::now()), field.data() + prefix.size()))
+    return;
+  std::memcpy(field.data() + prefix.size() + http_date_size, "\r\n", 2);
+
+  // single updater, so the sequence is only read back here
+  auto current = sequence.load(std::memory_order_relaxed);
+  sequence.store(current + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  for (size_t i = 0; i < field_words; ++i) {
+    uint64_t word;
+    std::memcpy(&word, field.data() + i * sizeof(word), sizeof(word));
+    field_data[i].store(word, std::memory_order_relaxed);
+  }
+  sequence.store(current + 2, std::memory_order_release);
+}
+
+void copy_date_field(char* out) {
+  std::array<char, field_words * sizeof(uint64_t)> field;
+  while (true) {
+    auto current = sequence.load(std::memory_order_acquire);
+    if (current & 1)
+      continue;
+    for (size_t i = 0; i < field_words; ++i) {
+      auto word = field_data[i].load(std::memory_order_relaxed);
+      std::memcpy(field.data() + i * sizeof(word), &word, sizeof(word));
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (sequence.load(std::memory_order_relaxed) == current)
+      break;
+  }
+  std::memcpy(out, field.data(), date_field_size);
+}
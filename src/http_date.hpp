@@ -0,0 +1,30 @@
+#pragma once
+#include <cstddef>
+#include <ctime>
+#include <string_view>
+
+// IMF-fixdate (RFC 7231), e.g. "Sun, 06 Nov 1994 08:49:37 GMT"
+constexpr size_t http_date_size = 29;
+// "Date:" + IMF-fixdate + CRLF
+constexpr size_t date_field_size = 36;
+
+// writes time as IMF-fixdate to out, which must have room for http_date_size + 1 characters
+// (terminating zero); returns false if the time can't be formatted
+bool format_http_date(std::time_t time, char* out);
+
+// parses IMF-fixdate, the only format generated by current clients; returns -1 if invalid
+std::time_t parse_http_date(std::string_view text);
+
+// process-wide cached date: formatted once per second by the single updater
+// (see http_date_updater in main.cpp), read lock-free by any number of threads
+
+// formats the current time; must be called once before the date is read
+void update_http_date();
+
+// copies "Date:<date>\r\n" to out, which must have room for date_field_size characters
+void copy_date_field(char* out);
+
+// date part of the field, e.g. "Sun, 06 Nov 1994 08:49:37 GMT"
+constexpr std::string_view date_from_field(std::string_view field) {
+  return field.substr(5, field.size() - 7);
+}
@@ -0,0 +1,148 @@
+#include "log.hpp"
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// single producer (owning thread), single consumer (log_getter) ring of formatted records
+class LogRing
+{
+public:
+  static constexpr size_t capacity = 256 * 1024;  // power of 2
+
+  // called by the owning thread only
+  bool push(std::string_view record) {
+    auto head_pos = head.load(std::memory_order_relaxed);
+    if (capacity - (head_pos - tail.load(std::memory_order_acquire)) < record.size()) {
+      dropped.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    auto offset = head_pos & (capacity - 1);
+    auto first = std::min(record.size(), capacity - offset);
+    std::memcpy(data.get() + offset, record.data(), first);
+    std::memcpy(data.get(), record.data() + first, record.size() - first);
+    head.store(head_pos + record.size(), std::memory_order_release);
+    return true;
+  }
+
+  // called by the consumer only; appends all available records to out
+  size_t drain(std::string& out) {
+    auto tail_pos = tail.load(std::memory_order_relaxed);
+    auto size = head.load(std::memory_order_acquire) - tail_pos;
+    auto offset = tail_pos & (capacity - 1);
+    auto first = std::min(size, capacity - offset);
+    out.append(data.get() + offset, first);
+    out.append(data.get(), size - first);
+    tail.store(tail_pos + size, std::memory_order_release);
+    return size;
+  }
+
+  size_t take_dropped() {
+    return dropped.exchange(0, std::memory_order_relaxed);
+  }
+
+private:
+  std::unique_ptr<char[]> data{ new char[capacity] };
+  alignas(64) std::atomic<size_t> head{ 0 };  // written by producer
+  alignas(64) std::atomic<size_t> tail{ 0 };  // written by consumer
+  std::atomic<size_t> dropped{ 0 };
+};
+
+// rings are registered once per thread and live until the end of the program,
+// so records of finished threads are still drained
+std::mutex mx_rings;
+std::vector<std::unique_ptr<LogRing>> rings;
+std::atomic_bool log_closed = false;
+
+LogRing& thread_ring() {
+  static thread_local LogRing* ring = nullptr;
+  if (!ring) {
+    std::lock_guard locker(mx_rings);
+    ring = rings.emplace_back(std::make_unique<LogRing>()).get();
+  }
+  return *ring;
+}
+
+thread_local fmt::memory_buffer thread_buffer;
+
+}  // namespace
+
+std::atomic<LogLevel> detail::min_log_level = LogLevel::debug;
+
+int curr_thread_id() {
+  // assigns progressive number to every thread
+  static thread_local int th_num = 0;
+  static std::atomic_int last_th_num = 0;
+  if (th_num == 0)
+    th_num = ++last_th_num;
+  return th_num;
+}
+
+void set_log_level(LogLevel level) {
+  detail::min_log_level.store(level, std::memory_order_relaxed);
+}
+
+bool parse_log_level(std::string_view name, LogLevel& level) {
+  constexpr std::pair<std::string_view, LogLevel> names[] = { { "debug", LogLevel::debug },
+    { "info", LogLevel::info }, { "warning", LogLevel::warning }, { "error", LogLevel::error },
+    { "off", LogLevel::off } };
+  for (auto& [level_name, value] : names)
+    if (name == level_name) {
+      level = value;
+      return true;
+    }
+  return false;
+}
+
+fmt::memory_buffer& detail::log_buffer(int conn_number) {
+  auto& buffer = thread_buffer;
+  buffer.clear();
+  fmt::format_to(buffer, "[thread {}] ", curr_thread_id());
+  if (conn_number)
+    fmt::format_to(buffer, "connection {}: ", conn_number);
+  return buffer;
+}
+
+void detail::push_log_buffer() {
+  thread_buffer.push_back('\n');
+  thread_ring().push({ thread_buffer.data(), thread_buffer.size() });
+}
+
+void log_getter(std::FILE* out) {
+  // records are collected in batches, a short delay lets a batch grow under load
+  constexpr auto poll_interval = std::chrono::milliseconds(10);
+  std::string batch;
+  std::vector<LogRing*> sources;
+  while (true) {
+    bool closing = log_closed.load();
+    {
+      std::lock_guard locker(mx_rings);
+      for (size_t i = sources.size(); i < rings.size(); ++i)
+        sources.push_back(rings[i].get());
+    }
+    size_t dropped = 0;
+    for (auto ring : sources) {
+      ring->drain(batch);
+      dropped += ring->take_dropped();
+    }
+    if (dropped)
+      batch += fmt::format("[log] {} records dropped\n", dropped);
+    if (!batch.empty()) {
+      std::fwrite(batch.data(), 1, batch.size(), out);
+      std::fflush(out);
+      batch.clear();
+    }
+    if (closing)
+      break;
+    std::this_thread::sleep_for(poll_interval);
+  }
+}
+
+void close_log() {
+  log_closed = true;
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include <fmt/format.h>
+#include <atomic>
+#include <cstdio>
+#include <string_view>
+
+enum class LogLevel { debug, info, warning, error, off };
+
+// progressive number of the current thread, starting with 1
+int curr_thread_id();
+
+namespace detail {
+extern std::atomic<LogLevel> min_log_level;
+}  // namespace detail
+
+void set_log_level(LogLevel level);
+inline bool log_enabled(LogLevel level) {
+  return level >= detail::min_log_level.load(std::memory_order_relaxed);
+}
+// accepts "debug", "info", "warning", "error", "off"; returns false for anything else
+bool parse_log_level(std::string_view name, LogLevel& level);
+
+namespace detail {
+// formatting buffer of the current thread, reused for every record
+fmt::memory_buffer& log_buffer(int conn_number);
+// moves the formatted record from log_buffer() to the ring of the current thread
+void push_log_buffer();
+}  // namespace detail
+
+// formats the record on the calling thread and puts it into its ring, never blocks;
+// records are dropped (and counted) when the ring is full
+template <class... Args>
+void write_log(LogLevel level, int conn_number, std::string_view format, const Args&... args) {
+  if (!log_enabled(level))
+    return;
+  auto& buffer = detail::log_buffer(conn_number);
+  fmt::format_to(buffer, format, args...);
+  detail::push_log_buffer();
+}
+
+template <class... Args>
+void log_debug(int conn_number, std::string_view format, const Args&... args) {
+  write_log(LogLevel::debug, conn_number, format, args...);
+}
+
+template <class... Args>
+void log_info(int conn_number, std::string_view format, const Args&... args) {
+  write_log(LogLevel::info, conn_number, format, args...);
+}
+
+template <class... Args>
+void log_warning(int conn_number, std::string_view format, const Args&... args) {
+  write_log(LogLevel::warning, conn_number, format, args...);
+}
+
+template <class... Args>
+void log_error(int conn_number, std::string_view format, const Args&... args) {
+  write_log(LogLevel::error, conn_number, format, args...);
+}
+
+// drains the rings of all threads into out, one write per batch, until close_log() is called
+void log_getter(std::FILE* out);
+void close_log();
@@ -1,32 +1,46 @@
 #include "main.hpp"
+#include "allocator.hpp"
+#include "assets.hpp"
+#include "cache_policy.hpp"
+#include "connections.hpp"
+#include "http_date.hpp"
+#include "log.hpp"
+#include "metrics.hpp"
+#include "asio_pool.hpp"
+#include "request.hpp"
 #include "response.hpp"
+#include "router.hpp"
+#include "timer_wheel.hpp"
+#include "uring.hpp"
 #include <asio.hpp>
 #include <fmt/format.h>
+#include <algorithm>
 #include <array>
 #include <atomic>
+#include <charconv>
+#include <cstdlib>
 #include <iostream>
+#include <memory>
+#include <thread>
 #include <utility>
-#include <experimental/generator>
+#include <span>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <sys/sendfile.h>
+#endif
 
 using std::string;
 using std::string_view;
 using std::tuple;
 
-auto curr_thread_id() {
-  // assigns progressive number to every thread
-  static thread_local int th_num = 0;
-  static std::atomic_int last_th_num = 0;
-  if (th_num == 0)
-    th_num = ++last_th_num;
-  return th_num;
-}
-
+// operation state is recycled through the per-thread pool, see asio_pool.hpp
 auto use_awaitable() {
-  return asio::use_awaitable;
+  return pooled(asio::use_awaitable);
 }
 
 auto use_awaitable(std::error_code& ec) {
-  return asio::redirect_error(asio::use_awaitable, ec);
+  return pooled(asio::redirect_error(asio::use_awaitable, ec));
 }
 
 void detach_rethrow(std::exception_ptr e) {
@@ -35,131 +49,504 @@ void detach_rethrow(std::exception_ptr e) {
   }
 }
 
-std::mutex mx_log;
-std::condition_variable log_check;
-std::vector<string> log_entries;
-std::atomic_bool close_log = false;
-
-class Log
-{
-  std::stringstream sstream;
-public:
-  Log(int conn_number = 0) {
-    sstream << "[thread " << curr_thread_id() << "] ";
-    if (conn_number)
-      sstream << "connection " << conn_number << ": ";
-  }
-  template<class T>
-  auto& operator<<(T&& arg) {
-    return sstream << std::forward<T>(arg);
-  }
-  ~Log() {
-    sstream << std::endl;
-    std::lock_guard locker(mx_log);
-    log_entries.push_back(sstream.str());
-    log_check.notify_one();
+#ifdef __linux__
+// sends the whole file region with sendfile, waiting for the socket to become writable as needed
+template <class Socket>
+asio::awaitable<size_t> send_file(Socket& socket, const FileRegion& file, ConnectionTimer& timer, std::error_code& ec) {
+  socket.native_non_blocking(true, ec);
+  off_t offset = 0;
+  while (!ec && uint64_t(offset) < file.size()) {
+    auto res = ::sendfile(socket.native_handle(), file.fd(), &offset, size_t(file.size() - uint64_t(offset)));
+    if (res > 0)
+      continue;
+    if (res == 0)
+      ec = asio::error::eof;  // file was truncated meanwhile
+    else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      timer.expires_after(connection_timeouts().write);
+      co_await socket.async_wait(asio::socket_base::wait_write, use_awaitable(ec));
+    }
+    else if (errno != EINTR)
+      ec = std::error_code(errno, std::system_category());
   }
-};
-
-auto log_getter() {
-  std::vector<string> entries;
-  while (true) {
-    for (auto& item : entries)
-      co_yield item;
-    entries.clear();
-    if (close_log)
-      break;
-    // wait for the next entries
-    std::unique_lock<std::mutex> locker(mx_log);
-    if (log_entries.empty())
-      log_check.wait(locker);
-    std::swap(entries, log_entries); // mutex is locked here
+  co_return size_t(offset);
+}
+#endif
+
+// writes responses in order: in-memory parts of consecutive responses go in one gathered write,
+// file bodies are sent with sendfile between them
+template <class Socket>
+asio::awaitable<size_t> write_responses(Socket& socket, std::span<Response> responses,
+  std::vector<asio::const_buffer, PoolAllocator<asio::const_buffer>>& buffers, ConnectionTimer& timer,
+  std::error_code& ec) {
+  size_t written = 0;
+  for (size_t i = 0; i < responses.size() && !ec; ++i) {
+    auto& response = responses[i];
+    buffers.push_back(asio::buffer(response.header_view()));
+    buffers.push_back(asio::buffer(response.tail_view()));
+    if (auto body = response.body_view(); !body.empty())
+      buffers.push_back(asio::buffer(body));
+    if (!response.file.is_open() && i + 1 < responses.size())
+      continue;
+    timer.expires_after(connection_timeouts().write);
+    written += co_await asio::async_write(socket, buffers, use_awaitable(ec));
+    buffers.clear();
+#ifdef __linux__
+    if (!ec && response.file.is_open())
+      written += co_await send_file(socket, response.file, timer, ec);
+#endif
+    response.file.close();
   }
+  buffers.clear();
+  co_return written;
 }
 
-auto make_http_handler(asio::ip::tcp::socket &&socket, int conn_number) {
-  return [socket = std::move(socket), conn_number]() mutable -> asio::awaitable<void> {
-    std::array<char, 1024> buffer;
-    while (true) {
+// Socket is asio::ip::tcp::socket or UringSocket; slot is released when the connection ends
+template <class Socket>
+auto make_http_handler(Socket&& socket, ConnectionSlot&& slot, int conn_number) {
+  return [socket = std::move(socket), slot = std::move(slot), conn_number]() mutable -> asio::awaitable<void> {
+    // responses to pipelined requests are collected and sent with one gathered write;
+    // Response objects are kept to reuse their buffers for the next requests
+    constexpr size_t max_batch = 32;
+    RequestParser parser;
+    Request request;
+    std::vector<Response, PoolAllocator<Response>> responses;
+    size_t response_count = 0;
+    std::vector<asio::const_buffer, PoolAllocator<asio::const_buffer>> buffers;
+    bool keep_alive = true;
+    auto received_at = std::chrono::steady_clock::now();
+    // a request must arrive within the header timeout from its first byte, however slowly it
+    // trickles, and a new connection must send its first byte within the header timeout too
+    auto& timeouts = connection_timeouts();
+    ConnectionTimer timer{ socket, co_await asio::this_coro::executor };
+    bool header_timer_armed = false;
+    bool answered = false;  // idle timeout applies only between requests
+    auto next_response = [&]() -> Response& {
+      if (response_count == responses.size())
+        responses.emplace_back();
+      return responses[response_count++];
+    };
+    while (keep_alive && !timer.expired()) {
+      auto status = RequestParser::Status::complete;
+      while (keep_alive && response_count < max_batch &&
+        (status = parser.next(request)) == RequestParser::Status::complete) {
+        log_debug(conn_number, "received: {} {} {}", request.method, request.url, request.protocol);
+        auto& response = next_response();
+        form_answer(request, response);
+        keep_alive = response.keep_alive;
+      }
+      if (status == RequestParser::Status::error) {
+        log_warning(conn_number, "bad request");
+        thread_metrics().parse_errors.add();
+        form_bad_request(next_response());
+        keep_alive = false;
+      }
+
       std::error_code ec;
-      const auto size = co_await socket.async_read_some(asio::buffer(buffer), use_awaitable(ec));
-      if (ec) {
-        if (ec.value()==2)
-          Log(conn_number) << "closed";
+      if (response_count) {
+        auto write_res = co_await write_responses(socket, { responses.data(), response_count }, buffers, timer, ec);
+        auto& metrics = thread_metrics();
+        metrics.bytes_out.add(write_res);
+        if (ec) {
+          if (!timer.expired())
+            log_warning(conn_number, "send error: {} ({})", ec.message(), ec.value());
+          break;
+        }
+        header_timer_armed = false;
+        answered = true;
+        metrics.heap_allocations.set(heap_allocation_count());
+        auto latency = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - received_at);
+        for (size_t i = 0; i < response_count; ++i) {
+          metrics.requests[size_t(responses[i].route)].add();
+          metrics.add_latency(uint64_t(latency.count()));
+        }
+        response_count = 0;
+        log_debug(conn_number, "{} bytes written", write_res);
+        continue;  // more requests may be buffered already
+      }
+
+      if (!parser.buffered()) {
+        // between requests: closed right away when draining
+        if (timer.draining()) {
+          keep_alive = false;
+          break;
+        }
+        if (answered) {
+          timer.expires_after(timeouts.idle, true);
+          header_timer_armed = false;
+        }
         else
-          Log(conn_number) << "recv error: " << ec.message() << " (" << ec.value() << ")";
-        break;
+          timer.expires_after(timeouts.header, true);
+      }
+      else if (!header_timer_armed) {
+        timer.expires_after(timeouts.header);
+        header_timer_armed = true;
       }
-      auto [method, url, protocol] = get_request(buffer.data(), size);
-      Log(conn_number) << "received: " << method << " " << url << " " << protocol;
-      auto answer = form_answer(method, url, protocol);
-      auto write_res = co_await asio::async_write(socket, asio::buffer(answer.data(), answer.size()), use_awaitable(ec));
+      auto space = parser.prepare();
+      const auto size = co_await socket.async_read_some(asio::buffer(space.data(), space.size()), use_awaitable(ec));
       if (ec) {
-        Log(conn_number) << "send error: " << ec.message() << " (" << ec.value() << ")";
+        if (timer.expired())
+          break;
+        if (ec == asio::error::eof)
+          log_info(conn_number, "closed");
+        else
+          log_warning(conn_number, "recv error: {} ({})", ec.message(), ec.value());
         break;
       }
-      Log(conn_number) << write_res << " bytes written";
+      parser.commit(size);
+      if (!header_timer_armed) {
+        timer.expires_after(timeouts.header);
+        header_timer_armed = true;
+      }
+      received_at = std::chrono::steady_clock::now();
+      thread_metrics().bytes_in.add(size);
+    }
+    if (timer.expired() && timer.draining() && !parser.buffered() && !response_count)
+      log_info(conn_number, "closed by the drain");  // was waiting for its next request
+    else if (timer.expired()) {
+      log_info(conn_number, "timed out");
+      thread_metrics().timeouts.add();
+    }
+    else if (!keep_alive) {
+      std::error_code ec;
+      socket.shutdown(asio::ip::tcp::socket::shutdown_send, ec);
+      log_info(conn_number, "closing");
+    }
+    thread_metrics().closed.add();
+  };
+}
+
+// refreshes the cached Date field at the beginning of every second
+auto http_date_updater() {
+  return []() -> asio::awaitable<void> {
+    using namespace std::chrono;
+    asio::system_timer timer{ co_await asio::this_coro::executor };
+    while (true) {
+      timer.expires_at(floor<seconds>(system_clock::now()) + seconds(1));
+      co_await timer.async_wait(use_awaitable());
+      update_http_date();
+    }
+  };
+}
+
+// logs per-thread metrics every interval
+auto metrics_reporter(std::chrono::seconds interval) {
+  return [interval]() -> asio::awaitable<void> {
+    asio::steady_timer timer{ co_await asio::this_coro::executor };
+    while (true) {
+      timer.expires_after(interval);
+      co_await timer.async_wait(use_awaitable());
+      log_metrics_summary();
     }
   };
 }
 
-auto server(asio::ip::tcp::endpoint endpoint) {
-  return [endpoint]() -> asio::awaitable<void> {
-    auto executor = co_await asio::this_coro::executor;
+// Acceptor is asio::ip::tcp::acceptor or UringAcceptor; returns when the io_context drains
+template <class Acceptor>
+asio::awaitable<void> accept_connections(Acceptor& acceptor, asio::ip::tcp::endpoint endpoint) {
+  auto executor = co_await asio::this_coro::executor;
+  auto& slots = asio::use_service<ConnectionSlots>(static_cast<asio::io_context&>(executor.context()));
+  slots.add_acceptor([&acceptor] {
+    std::error_code ec;
+    acceptor.cancel(ec);
+  });
+  asio::steady_timer pause{ executor };
+  bool paused = false;
+  while (!slots.draining()) {
+    std::error_code ec;
+    if (slots.full()) {
+      // at a connection limit new connections wait in the listen backlog; a slot is freed
+      // by a connection of any thread, so it's checked again every tick
+      if (!paused && !slots.draining()) {
+        log_info(0, "connection limit reached on port {}, accepting paused", endpoint.port());
+        thread_metrics().accept_pauses.add();
+        paused = true;
+      }
+      pause.expires_after(TimerWheel::tick);
+      co_await pause.async_wait(use_awaitable(ec));
+      continue;
+    }
+    paused = false;
+    // wait for incoming connection
+    auto socket = co_await acceptor.async_accept(use_awaitable(ec));
+    if (ec) {
+      if (!slots.draining())
+        log_warning(0, "accept error: {} ({})", ec.message(), ec.value());
+      continue;
+    }
+    auto slot = slots.open_connection();
+    thread_metrics().accepted.add();
+    static std::atomic_int number{ 0 };
+    int conn_number = ++number;
+    if (log_enabled(LogLevel::info))  // to_string() allocates
+      log_info(conn_number, "on port {} from {}", endpoint.port(), socket.remote_endpoint(ec).address().to_string());
+    // with several threads on the io_context a connection runs on a strand, the timer wheel
+    // cancels its socket through it
+    auto connection_executor = shared_contexts() ? asio::executor(asio::make_strand(executor)) : executor;
+    co_spawn(connection_executor, make_http_handler(std::move(socket), std::move(slot), conn_number),
+      detach_rethrow);
+  }
+}
+
+// asio: sockets driven by the reactor (epoll); uring: io_uring with multishot accept,
+// provided read buffers and registered asset buffers, see uring.hpp
+enum class IoBackend { asio, uring };
+
+// with reuse_port every shard owns an acceptor on the same port and the kernel balances connections between them
+auto server(asio::io_context& context, asio::ip::tcp::endpoint endpoint, bool reuse_port, IoBackend backend) {
+  return [&context, endpoint, reuse_port, backend]() -> asio::awaitable<void> {
     auto ip_and_port = endpoint.address().to_string() + ":" + std::to_string(endpoint.port());
     try {
-      asio::ip::tcp::acceptor acceptor{ executor, endpoint, false };
-      Log() << "server starts on " << ip_and_port;
-      while (true) {
-        std::error_code ec;
-        // wait for incoming connection
-        auto socket = co_await acceptor.async_accept(use_awaitable(ec));
-        if (ec) {
-          Log() << "accept error: " << ec.message() << " (" << ec.value() << ")";
-          continue;
-        }
-        static std::atomic_int number{ 0 };
-        int conn_number = ++number;
-        Log(conn_number) << "on port " << endpoint.port() << " from " << socket.remote_endpoint().address().to_string();
-        co_spawn(executor, make_http_handler(std::move(socket), conn_number), detach_rethrow);
+      asio::ip::tcp::acceptor acceptor{ context, endpoint.protocol() };
+      if (reuse_port) {
+#ifdef SO_REUSEPORT
+        acceptor.set_option(asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>(true));
+#endif
       }
+      acceptor.bind(endpoint);
+      acceptor.listen();
+      log_info(0, "server starts on {}", ip_and_port);
+#ifdef HAS_IO_URING
+      if (backend == IoBackend::uring) {
+        // accepting has to pause at a connection limit, which a multishot accept doesn't
+        UringAcceptor uring_acceptor{ asio::use_service<UringService>(context), std::move(acceptor),
+          !connection_limits_set() };
+        co_await accept_connections(uring_acceptor, endpoint);
+      }
+#endif
+      if (backend == IoBackend::asio)
+        co_await accept_connections(acceptor, endpoint);
+      log_info(0, "server on {} stops accepting", ip_and_port);
     }
     catch (asio::system_error & ex) {
-      Log() << "server on " << ip_and_port << " error:" << ex.code();
+      log_error(0, "server on {} error: {} ({})", ip_and_port, ex.code().message(), ex.code().value());
+    }
+  };
+}
+
+
+// shared: one io_context run by all threads, connections may migrate between threads;
+// sharded: io_context per thread pinned to a CPU, a connection lives and dies on one core
+enum class ServerMode { shared, sharded };
+
+constexpr bool io_uring_supported() {
+#ifdef HAS_IO_URING
+  return true;
+#else
+  return false;
+#endif
+}
+
+constexpr bool reuse_port_supported() {
+#ifdef SO_REUSEPORT
+  return true;
+#else
+  return false;
+#endif
+}
+
+// stops accepting and closes idle connections, lets the others finish their current requests,
+// then stops the io_contexts when all connections are closed or after timeout
+auto drain_connections(std::vector<std::unique_ptr<asio::io_context>>& contexts, std::chrono::seconds timeout) {
+  return [&contexts, timeout]() -> asio::awaitable<void> {
+    log_info(0, "draining {} connections...", open_connection_count());
+    set_draining();
+    for (auto& context : contexts)
+      asio::post(*context, [&context = *context] { asio::use_service<ConnectionSlots>(context).drain(); });
+    asio::steady_timer timer{ co_await asio::this_coro::executor };
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (open_connection_count() > 0 && std::chrono::steady_clock::now() < deadline) {
+      timer.expires_after(TimerWheel::tick);
+      co_await timer.async_wait(use_awaitable());
     }
+    if (int open = open_connection_count())
+      log_warning(0, "{} connections still open after the drain timeout", open);
+    log_info(0, "terminating...");
+    close_log();
+    for (auto& context : contexts)
+      context->stop();
   };
 }
 
+// non-negative integer option value; false if the whole text isn't one
+bool parse_number(string_view text, int& value) {
+  int result = 0;
+  auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), result);
+  if (ec != std::errc{} || end != text.data() + text.size() || result < 0)
+    return false;
+  value = result;
+  return true;
+}
+
+bool parse_seconds(string_view text, std::chrono::seconds& value) {
+  int seconds = 0;
+  if (!parse_number(text, seconds))
+    return false;
+  value = std::chrono::seconds(seconds);
+  return true;
+}
+
+// CPUs the process may run on, as restricted by taskset or a cgroup cpuset
+std::vector<int> allowed_cpus() {
+  std::vector<int> cpus;
+#if defined(_WIN32)
+  DWORD_PTR process_mask = 0, system_mask = 0;
+  if (GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask))
+    for (int cpu = 0; cpu < int(sizeof(process_mask) * 8); ++cpu)
+      if (process_mask & (DWORD_PTR(1) << cpu))
+        cpus.push_back(cpu);
+#elif defined(__linux__)
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  if (sched_getaffinity(0, sizeof(cpu_set), &cpu_set) == 0)
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+      if (CPU_ISSET(cpu, &cpu_set))
+        cpus.push_back(cpu);
+#endif
+  if (cpus.empty())
+    for (int cpu = 0; cpu < int(std::max(1u, std::thread::hardware_concurrency())); ++cpu)
+      cpus.push_back(cpu);
+  return cpus;
+}
+
+void pin_to_cpu(int cpu) {
+#if defined(_WIN32)
+  SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << cpu);
+#elif defined(__linux__)
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  CPU_SET(cpu, &cpu_set);
+  if (int err = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set))
+    log_warning(0, "can't pin thread to cpu {}: {}", cpu, std::generic_category().message(err));
+#endif
+}
 
-int main() {
+int main(int argc, char* argv[]) {
   try {
+    constexpr string_view usage =
+      "supported: --mode=shared|sharded --threads=N --files=DIR --max-age=assets:S,files:S,pages:S "
+      "--metrics-interval=SECONDS --backend=asio|uring --max-connections=N --max-thread-connections=N "
+      "--header-timeout=S --idle-timeout=S --write-timeout=S --drain-timeout=S "
+      "--log-level=debug|info|warning|error|off";
+    auto mode = ServerMode::shared;
+    auto backend = IoBackend::asio;
+    auto metrics_interval = std::chrono::seconds(60);
+    auto drain_timeout = std::chrono::seconds(10);
+    ConnectionTimeouts timeouts;
+    int max_connections = 0;
+    int max_thread_connections = 0;
     int work_thread_count = std::thread::hardware_concurrency();
-    if (!work_thread_count)
+    for (int i = 1; i < argc; ++i) {
+      string_view arg = argv[i];
+      LogLevel level;
+      if (arg.starts_with("--log-level=") && parse_log_level(arg.substr(12), level))
+        set_log_level(level);
+      else if (arg == "--mode=shared")
+        mode = ServerMode::shared;
+      else if (arg == "--mode=sharded" && reuse_port_supported())
+        mode = ServerMode::sharded;
+      else if (arg == "--backend=asio")
+        backend = IoBackend::asio;
+      else if (arg == "--backend=uring" && io_uring_supported())
+        backend = IoBackend::uring;
+      else if (arg.starts_with("--threads=") && parse_number(arg.substr(10), work_thread_count))
+        continue;
+      else if (arg.starts_with("--files="))
+        set_files_root(arg.substr(8));
+      else if (arg.starts_with("--max-age=") && parse_max_age(arg.substr(10)))
+        continue;
+      else if (arg.starts_with("--metrics-interval=") && parse_seconds(arg.substr(19), metrics_interval))
+        continue;
+      else if (arg.starts_with("--max-connections=") && parse_number(arg.substr(18), max_connections))
+        continue;
+      else if (arg.starts_with("--max-thread-connections=") && parse_number(arg.substr(25), max_thread_connections))
+        continue;
+      else if (arg.starts_with("--header-timeout=") && parse_seconds(arg.substr(17), timeouts.header))
+        continue;
+      else if (arg.starts_with("--idle-timeout=") && parse_seconds(arg.substr(15), timeouts.idle))
+        continue;
+      else if (arg.starts_with("--write-timeout=") && parse_seconds(arg.substr(16), timeouts.write))
+        continue;
+      else if (arg.starts_with("--drain-timeout=") && parse_seconds(arg.substr(16), drain_timeout))
+        continue;
+      else
+        throw std::invalid_argument(fmt::format("unknown argument or invalid value {}, {}", arg, usage));
+    }
+    load_assets();
+    update_http_date();
+    Router router;
+    add_default_routes(router);
+    set_router(std::move(router));
+
+    if (work_thread_count <= 0)
       work_thread_count = 1;
-    std::cout << work_thread_count << " working threads" << std::endl;
-    asio::io_context context{ work_thread_count };
-
-    asio::signal_set signals{ context, SIGINT, SIGTERM };
-    signals.async_wait([&](auto, auto) {
-      close_log = true;
-      Log() << "terminating...";
-      context.stop();
+    const auto cpus = allowed_cpus();
+    // a ring is used by one thread only
+    if (backend == IoBackend::uring && mode == ServerMode::shared && work_thread_count > 1)
+      throw std::invalid_argument("--backend=uring needs --mode=sharded or --threads=1");
+    std::cout << work_thread_count << " working threads, " << (mode == ServerMode::shared ? "shared" : "sharded")
+              << " mode, " << (backend == IoBackend::asio ? "asio" : "io_uring") << " backend" << std::endl;
+
+    set_connection_timeouts(timeouts);
+    set_shared_contexts(mode == ServerMode::shared && work_thread_count > 1);
+    // the per-thread limit applies to the io_context shared by all threads as a whole
+    set_connection_limits(max_connections,
+      mode == ServerMode::shared ? max_thread_connections * work_thread_count : max_thread_connections);
+
+    std::vector<std::unique_ptr<asio::io_context>> contexts;
+    if (mode == ServerMode::shared)
+      contexts.push_back(std::make_unique<asio::io_context>(work_thread_count));
+    else
+      for (int i = 0; i < work_thread_count; ++i)
+        contexts.push_back(std::make_unique<asio::io_context>(1));
+#ifdef HAS_IO_URING
+    // rings are set up now to fail at startup when io_uring is not available
+    if (backend == IoBackend::uring)
+      for (auto& context : contexts)
+        asio::use_service<UringService>(*context);
+#endif
+
+    asio::signal_set signals{ *contexts.front(), SIGINT, SIGTERM };
+    signals.async_wait([&](std::error_code ec, int) {
+      if (ec)
+        return;
+      asio::co_spawn(*contexts.front(), drain_connections(contexts, drain_timeout), detach_rethrow);
+      // a second signal doesn't wait for the connections
+      signals.async_wait([&](std::error_code ec, int) {
+        if (ec)
+          return;
+        log_info(0, "terminating...");
+        close_log();
+        for (auto& context : contexts)
+          context->stop();
+      });
     });
 
+    asio::co_spawn(*contexts.front(), http_date_updater(), detach_rethrow);
+    if (metrics_interval.count() > 0)
+      asio::co_spawn(*contexts.front(), metrics_reporter(metrics_interval), detach_rethrow);
+
     const char* host = "127.0.0.1";
-    auto endpoint = asio::ip::tcp::resolver{ context }.resolve(host, "8888")->endpoint();
-    asio::co_spawn(context, server(endpoint), detach_rethrow);
-    auto endpoint2 = asio::ip::tcp::resolver{ context }.resolve(host, "7777")->endpoint();
-    asio::co_spawn(context, server(endpoint2), detach_rethrow);
+    const bool reuse_port = mode == ServerMode::sharded;
+    for (const char* port : { "8888", "7777" }) {
+      auto endpoint = asio::ip::tcp::resolver{ *contexts.front() }.resolve(host, port)->endpoint();
+      for (auto& context : contexts)
+        asio::co_spawn(*context, server(*context, endpoint, reuse_port, backend), detach_rethrow);
+    }
 
     // context.run(); in multiple threads
     std::vector<std::thread> threads;
-    for (int i = 0; i < work_thread_count; ++i)
-      threads.emplace_back([&context] {context.run(); });
+    for (int i = 0; i < work_thread_count; ++i) {
+      if (mode == ServerMode::shared)
+        threads.emplace_back([&context = *contexts.front()] { context.run(); });
+      else
+        threads.emplace_back([&context = *contexts[i], cpu = cpus[i % cpus.size()]] {
+          pin_to_cpu(cpu);
+          context.run();
+        });
+    }
 
     // get log entries as they appear and put them in std output
-    for (auto& log : log_getter())
-      std::cout << log;
+    log_getter(stdout);
 
     for (auto& th : threads)
       th.join();
@@ -168,4 +555,3 @@ int main() {
     fmt::print(stderr, "error: {}\n", e.what());
   }
 }
-
@@ -0,0 +1,151 @@
+#include "metrics.hpp"
+#include "log.hpp"
+#include "page_template.hpp"
+#include <fmt/format.h>
+#include <algorithm>
+#include <iterator>
+#include <memory>
+#include <mutex>
+
+namespace {
+
+// slots are registered once per thread and never freed, so readers can keep pointers
+std::mutex mx_slots;
+std::vector<std::unique_ptr<ThreadMetrics>> slots;
+
+std::vector<std::string> route_names;  // set at startup, then only read
+
+// Prometheus bucket boundaries for the latency histogram, microseconds
+constexpr uint64_t latency_buckets[] = { 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000,
+  500000, 1000000, 2500000, 5000000, 10000000 };
+
+}  // namespace
+
+void set_route_names(std::vector<std::string> names) {
+  route_names = std::move(names);
+}
+
+ThreadMetrics& thread_metrics() {
+  static thread_local ThreadMetrics* slot = nullptr;
+  if (!slot) {
+    auto metrics = std::make_unique<ThreadMetrics>(route_names.size());
+    metrics->thread_id = curr_thread_id();
+    std::lock_guard locker(mx_slots);
+    slot = slots.emplace_back(std::move(metrics)).get();
+  }
+  return *slot;
+}
+
+void collect_metrics(std::vector<MetricsSnapshot>& snapshots) {
+  static thread_local std::vector<ThreadMetrics*> sources;
+  sources.clear();
+  {
+    std::lock_guard locker(mx_slots);
+    for (auto& slot : slots)
+      sources.push_back(slot.get());
+  }
+  snapshots.resize(sources.size());
+  for (size_t i = 0; i < sources.size(); ++i) {
+    auto& source = *sources[i];
+    auto& snapshot = snapshots[i];
+    auto requests = std::move(snapshot.requests);  // keeps its capacity
+    snapshot = {};
+    snapshot.requests = std::move(requests);
+    snapshot.thread_id = source.thread_id;
+    snapshot.accepted = source.accepted.get();
+    snapshot.closed = source.closed.get();
+    snapshot.bytes_in = source.bytes_in.get();
+    snapshot.bytes_out = source.bytes_out.get();
+    snapshot.parse_errors = source.parse_errors.get();
+    snapshot.timeouts = source.timeouts.get();
+    snapshot.accept_pauses = source.accept_pauses.get();
+    snapshot.requests.resize(source.requests.size());
+    for (size_t route = 0; route < snapshot.requests.size(); ++route)
+      snapshot.requests[route] = source.requests[route].get();
+    for (size_t bucket = 0; bucket < source.latency.size(); ++bucket)
+      if (auto count = source.latency[bucket].get())
+        snapshot.latency.add_bucket(bucket, count);
+    snapshot.latency_sum = source.latency_sum.get();
+    snapshot.heap_allocations = source.heap_allocations.get();
+  }
+  std::sort(snapshots.begin(), snapshots.end(), [](auto& a, auto& b) { return a.thread_id < b.thread_id; });
+}
+
+void render_metrics(std::vector<char>& out) {
+  // kept between requests, /metrics is scraped periodically over a keep-alive connection
+  static thread_local std::vector<MetricsSnapshot> snapshots;
+  collect_metrics(snapshots);
+  auto it = std::back_inserter(out);
+  auto counter = [&](std::string_view name, std::string_view help, auto field) {
+    fmt::format_to(it, "# HELP experiments_{} {}\n# TYPE experiments_{} counter\n", name, help, name);
+    for (auto& snapshot : snapshots)
+      fmt::format_to(it, "experiments_{}{{thread=\"{}\"}} {}\n", name, snapshot.thread_id, snapshot.*field);
+  };
+  counter("connections_accepted_total", "Accepted connections.", &MetricsSnapshot::accepted);
+  counter("connections_closed_total", "Closed connections.", &MetricsSnapshot::closed);
+  counter("received_bytes_total", "Bytes received from clients.", &MetricsSnapshot::bytes_in);
+  counter("sent_bytes_total", "Bytes sent to clients.", &MetricsSnapshot::bytes_out);
+  counter("parse_errors_total", "Requests that could not be parsed.", &MetricsSnapshot::parse_errors);
+  counter("connection_timeouts_total", "Connections closed by a header, idle or write timeout.",
+    &MetricsSnapshot::timeouts);
+  counter("accept_pauses_total", "Times accepting paused at a connection limit.", &MetricsSnapshot::accept_pauses);
+#ifndef NDEBUG
+  counter("heap_allocations_total", "Heap allocations made by the thread, as of its last response.",
+    &MetricsSnapshot::heap_allocations);
+#endif
+
+  // connections can be accepted and closed on different threads in the shared mode, so only the sum is exact
+  uint64_t accepted = 0, closed = 0;
+  for (auto& snapshot : snapshots) {
+    accepted += snapshot.accepted;
+    closed += snapshot.closed;
+  }
+  fmt::format_to(it,
+    "# HELP experiments_connections_active Open connections.\n"
+    "# TYPE experiments_connections_active gauge\n"
+    "experiments_connections_active {}\n",
+    accepted - closed);
+
+  append(out, "# HELP experiments_requests_total Handled requests.\n# TYPE experiments_requests_total counter\n");
+  for (auto& snapshot : snapshots)
+    for (size_t route = 0; route < snapshot.requests.size(); ++route)
+      fmt::format_to(it, "experiments_requests_total{{thread=\"{}\",route=\"{}\"}} {}\n", snapshot.thread_id,
+        route_names[route], snapshot.requests[route]);
+
+  append(out,
+    "# HELP experiments_request_duration_seconds Time from receiving a request to sending the last byte of the response.\n"
+    "# TYPE experiments_request_duration_seconds histogram\n");
+  for (auto& snapshot : snapshots) {
+    // log-linear buckets are summed up to the Prometheus boundaries
+    size_t bucket = 0;
+    uint64_t cumulative = 0;
+    for (auto bound : latency_buckets) {
+      for (; bucket < Histogram::bucket_count() && Histogram::upper_bound(bucket) <= bound; ++bucket)
+        cumulative += snapshot.latency.bucket(bucket);
+      fmt::format_to(it, "experiments_request_duration_seconds_bucket{{thread=\"{}\",le=\"{}\"}} {}\n",
+        snapshot.thread_id, double(bound) / 1e6, cumulative);
+    }
+    fmt::format_to(it,
+      "experiments_request_duration_seconds_bucket{{thread=\"{}\",le=\"+Inf\"}} {}\n"
+      "experiments_request_duration_seconds_sum{{thread=\"{}\"}} {}\n"
+      "experiments_request_duration_seconds_count{{thread=\"{}\"}} {}\n",
+      snapshot.thread_id, snapshot.latency.count(), snapshot.thread_id, double(snapshot.latency_sum) / 1e6,
+      snapshot.thread_id, snapshot.latency.count());
+  }
+}
+
+void log_metrics_summary() {
+  if (!log_enabled(LogLevel::info))
+    return;
+  std::vector<MetricsSnapshot> snapshots;
+  collect_metrics(snapshots);
+  for (auto& snapshot : snapshots) {
+    uint64_t requests = 0;
+    for (auto count : snapshot.requests)
+      requests += count;
+    log_info(0, "metrics of thread {}: accepted {}, closed {}, requests {}, in {} B, out {} B, parse errors {}, "
+      "latency p50 {} us, p99 {} us, max {} us", snapshot.thread_id, snapshot.accepted, snapshot.closed, requests,
+      snapshot.bytes_in, snapshot.bytes_out, snapshot.parse_errors, snapshot.latency.quantile(0.5),
+      snapshot.latency.quantile(0.99), snapshot.latency.max());
+  }
+}
@@ -0,0 +1,88 @@
+#pragma once
+#include "histogram.hpp"
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// labels of the request counters, indexed by route id (Router::route_names()); call once at
+// startup, before any thread records metrics: the counters of a thread are sized by it
+void set_route_names(std::vector<std::string> names);
+
+// counter written only by its owning thread: plain relaxed load and store, no read-modify-write,
+// so updates cost the same as for a non-atomic variable while other threads can read it
+class MetricCounter
+{
+public:
+  void add(uint64_t n = 1) {
+    value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  }
+  // publishes a value counted elsewhere by the owning thread
+  void set(uint64_t n) {
+    value.store(n, std::memory_order_relaxed);
+  }
+  uint64_t get() const {
+    return value.load(std::memory_order_relaxed);
+  }
+
+private:
+  std::atomic<uint64_t> value{ 0 };
+};
+
+// metrics of one thread; a coroutine may resume on another thread of a shared io_context,
+// so take thread_metrics() again after every co_await instead of keeping the reference
+struct alignas(64) ThreadMetrics {
+  explicit ThreadMetrics(size_t route_count) : requests(route_count) {
+  }
+
+  int thread_id = 0;  // curr_thread_id() of the owner
+  MetricCounter accepted;
+  MetricCounter closed;  // may be counted on another thread than accepted in the shared mode
+  MetricCounter bytes_in;
+  MetricCounter bytes_out;
+  MetricCounter parse_errors;
+  MetricCounter timeouts;       // connections closed by a header, idle or write timeout
+  MetricCounter accept_pauses;  // times accepting stopped at a connection limit
+  std::vector<MetricCounter> requests;  // per route id
+  // time from receiving a request to writing the last byte of its response, microseconds
+  std::array<MetricCounter, Histogram::bucket_count()> latency;
+  MetricCounter latency_sum;
+  // heap_allocation_count() of the thread as of its last response batch, debug builds only;
+  // stays flat under a steady keep-alive load when requests don't allocate
+  MetricCounter heap_allocations;
+
+  void add_latency(uint64_t microseconds) {
+    latency[Histogram::bucket_index(microseconds)].add();
+    latency_sum.add(microseconds);
+  }
+};
+
+// slot of the calling thread, registered on first use
+ThreadMetrics& thread_metrics();
+
+// aggregated snapshot of one thread
+struct MetricsSnapshot {
+  int thread_id = 0;
+  uint64_t accepted = 0;
+  uint64_t closed = 0;
+  uint64_t bytes_in = 0;
+  uint64_t bytes_out = 0;
+  uint64_t parse_errors = 0;
+  uint64_t timeouts = 0;
+  uint64_t accept_pauses = 0;
+  std::vector<uint64_t> requests;  // per route id
+  Histogram latency;
+  uint64_t latency_sum = 0;
+  uint64_t heap_allocations = 0;
+};
+
+// snapshots of all threads that have recorded anything, ordered by thread id; snapshots is
+// overwritten, so a caller can keep it to avoid allocations
+void collect_metrics(std::vector<MetricsSnapshot>& snapshots);
+
+// appends all metrics in the Prometheus text format
+void render_metrics(std::vector<char>& out);
+
+// one line per thread with the main numbers, for the periodic log summary
+void log_metrics_summary();
@@ -0,0 +1,88 @@
+#pragma once
+#include "compress.hpp"
+#include <algorithm>
+#include <initializer_list>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// appends text to the output buffer
+inline void append(std::vector<char>& out, std::string_view text) {
+  out.insert(out.end(), text.begin(), text.end());
+}
+
+// text with "%name%" placeholders, parsed once into static segments and typed slots;
+// the text is not copied and must outlive the template. Static segments are also
+// compressed once here, so gzip responses only compress the slot values
+template <class Slot>
+class PageTemplate
+{
+public:
+  PageTemplate(std::string_view text, std::initializer_list<std::pair<std::string_view, Slot>> slots) {
+    while (true) {
+      auto placeholder = text.find('%');
+      auto placeholder_end = placeholder == text.npos ? text.npos : text.find('%', placeholder + 1);
+      if (placeholder_end == text.npos) {
+        add_segment(text, nullptr);
+        break;
+      }
+      auto name = text.substr(placeholder + 1, placeholder_end - placeholder - 1);
+      auto slot = std::find_if(slots.begin(), slots.end(), [name](auto& item) { return item.first == name; });
+      // unknown placeholders are rendered as empty
+      add_segment(text.substr(0, placeholder), slot == slots.end() ? nullptr : &slot->second);
+      text.remove_prefix(placeholder_end + 1);
+    }
+  }
+
+  // total size of the static segments
+  size_t static_size() const {
+    return static_size_;
+  }
+
+  // appends the page to out; fill(slot, out) appends the value of a slot
+  template <class F>
+  void render(std::vector<char>& out, F&& fill) const {
+    for (auto& segment : segments) {
+      append(out, segment.text);
+      if (segment.has_slot)
+        fill(segment.slot, out);
+    }
+  }
+
+  // appends the page to out as a gzip stream; slot values are rendered into a scratch buffer
+  // and compressed on the fly, precompressed static segments are copied in between
+  template <class F>
+  void render_gzip(std::vector<char>& out, F&& fill) const {
+    GzipWriter writer{ out };
+    auto& scratch = GzipWriter::scratch();
+    for (auto& segment : segments) {
+      writer.append(segment.compressed);
+      if (segment.has_slot) {
+        scratch.clear();
+        fill(segment.slot, scratch);
+        writer.compress({ scratch.data(), scratch.size() });
+      }
+    }
+    writer.finish();
+  }
+
+private:
+  struct Segment {
+    std::string_view text;  // followed by the slot, if any
+    Slot slot{};
+    bool has_slot = false;
+    CompressedSegment compressed;
+  };
+
+  void add_segment(std::string_view text, const Slot* slot) {
+    if (text.empty() && !slot)
+      return;
+    segments.push_back({ text, slot ? *slot : Slot{}, slot != nullptr, {} });
+    if (gzip_supported() && !text.empty())
+      segments.back().compressed = compress_segment(text);
+    static_size_ += text.size();
+  }
+
+  std::vector<Segment> segments;
+  size_t static_size_ = 0;
+};
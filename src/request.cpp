@@ -0,0 +1,127 @@
+#include "request.hpp"
+#include "header_values.hpp"
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+
+using namespace std;
+
+namespace {
+
+constexpr string_view crlf = "\r\n";
+
+}  // namespace
+
+string_view Request::header(string_view name) const {
+  for (size_t i = 0; i < header_count; ++i)
+    if (iequals(headers[i].name, name))
+      return headers[i].value;
+  return {};
+}
+
+RequestParser::RequestParser() : buffer(initial_buffer_size) {
+}
+
+span<char> RequestParser::prepare() {
+  if (parsed) {
+    // move the incomplete request to the beginning
+    std::memmove(buffer.data(), buffer.data() + parsed, received - parsed);
+    received -= parsed;
+    scanned -= parsed;
+    parsed = 0;
+  }
+  if (buffer.size() - received < initial_buffer_size / 2)
+    buffer.resize(buffer.size() * 2);
+  return { buffer.data() + received, buffer.size() - received };
+}
+
+void RequestParser::commit(size_t size) {
+  received += size;
+}
+
+RequestParser::Status RequestParser::next(Request& request) {
+  if (head_size) {
+    // the head was found by an earlier call, only wait for the rest of the body
+    if (received - parsed < head_size + body_size)
+      return Status::incomplete;
+  }
+  else {
+    // empty lines before request line are allowed
+    while (parsed < received && (buffer[parsed] == '\r' || buffer[parsed] == '\n'))
+      ++parsed;
+    scanned = std::max(scanned, parsed);
+
+    const char* begin = buffer.data() + parsed;
+    const char* end = buffer.data() + received;
+    // continue looking for the end of header where the previous attempt stopped
+    constexpr string_view terminator = "\r\n\r\n";
+    auto overlap = terminator.size() - 1;
+    const char* search_from = buffer.data() + std::max(scanned, parsed + overlap) - overlap;
+    const char* head_end = std::search(search_from, end, terminator.begin(), terminator.end());
+    if (head_end == end) {
+      scanned = received;
+      return size_t(end - begin) > max_header_size ? Status::error : Status::incomplete;
+    }
+    head_end += terminator.size();
+    if (size_t(head_end - begin) > max_header_size)
+      return Status::error;
+    head_size = size_t(head_end - begin);
+  }
+
+  // the head is parsed again once the body is complete: prepare() may have moved it since
+  const char* begin = buffer.data() + parsed;
+  const char* head_end = begin + head_size;
+  if (parse_head(begin, head_end, request) != Status::complete)
+    return Status::error;
+
+  body_size = 0;
+  if (!request.header("Transfer-Encoding").empty())
+    return Status::error;  // chunked request bodies are not supported
+  if (auto length = request.header("Content-Length"); !length.empty()) {
+    auto [ptr, ec] = std::from_chars(length.data(), length.data() + length.size(), body_size);
+    if (ec != std::errc{} || ptr != length.data() + length.size() || body_size > max_body_size)
+      return Status::error;
+  }
+  if (received - parsed < head_size + body_size)
+    return Status::incomplete;  // header is found, wait for the body
+  request.body = { head_end, body_size };
+  parsed += head_size + body_size;
+  scanned = parsed;
+  head_size = 0;
+  return Status::complete;
+}
+
+RequestParser::Status RequestParser::parse_head(const char* begin, const char* end, Request& request) const {
+  // request line: method SP url SP protocol CRLF
+  auto line_end = std::search(begin, end, crlf.begin(), crlf.end());
+  auto method_end = std::find(begin, line_end, ' ');
+  auto url_end = std::find(method_end + (method_end != line_end), line_end, ' ');
+  if (method_end == begin || method_end == line_end || url_end == line_end || url_end == method_end + 1)
+    return Status::error;
+  request.method = { begin, size_t(method_end - begin) };
+  request.url = { method_end + 1, size_t(url_end - method_end - 1) };
+  request.protocol = { url_end + 1, size_t(line_end - url_end - 1) };
+  if (!request.protocol.starts_with("HTTP/1."))
+    return Status::error;
+
+  // header fields: name ":" OWS value OWS CRLF, up to the empty line
+  request.header_count = 0;
+  for (auto line = line_end + 2; line != end - 2; line = line_end + 2) {
+    line_end = std::search(line, end, crlf.begin(), crlf.end());
+    auto colon = std::find(line, line_end, ':');
+    if (colon == line || colon == line_end || *line == ' ' || *line == '\t')
+      return Status::error;  // no name or obsolete line folding
+    if (request.header_count == Request::max_headers)
+      return Status::error;
+    auto value = trim({ colon + 1, size_t(line_end - colon - 1) });
+    request.headers[request.header_count++] = { { line, size_t(colon - line) }, value };
+  }
+
+  // HTTP/1.1 keeps connection open by default, HTTP/1.0 closes it
+  auto connection = request.header("Connection");
+  if (request.protocol == "HTTP/1.0")
+    request.keep_alive = has_token(connection, "keep-alive");
+  else
+    request.keep_alive = !has_token(connection, "close");
+  return Status::complete;
+}
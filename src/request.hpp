@@ -0,0 +1,63 @@
+#pragma once
+#include "allocator.hpp"
+#include <array>
+#include <span>
+#include <string_view>
+#include <vector>
+
+// parsed request; all views point into the RequestParser buffer
+struct Request {
+  struct Header {
+    std::string_view name;
+    std::string_view value;
+  };
+  static constexpr size_t max_headers = 32;
+
+  std::string_view method;
+  std::string_view url;
+  std::string_view protocol;
+  std::array<Header, max_headers> headers;
+  size_t header_count = 0;
+  std::string_view body;
+  bool keep_alive = true;
+
+  // value of the first header with this name (case insensitive), empty if absent
+  std::string_view header(std::string_view name) const;
+};
+
+// incremental HTTP/1.x request parser working on a growable per-connection buffer:
+// requests may span several reads and one read may contain several (pipelined) requests
+class RequestParser
+{
+public:
+  enum class Status { complete, incomplete, error };
+
+  static constexpr size_t initial_buffer_size = 4096;
+  static constexpr size_t max_header_size = 16 * 1024;
+  static constexpr size_t max_body_size = 1024 * 1024;
+
+  RequestParser();
+
+  // free space to read into; drops already parsed requests, so it invalidates previous Request views
+  std::span<char> prepare();
+  // marks size bytes of the prepared space as received
+  void commit(size_t size);
+
+  // parses the next buffered request; on error the connection should be closed
+  Status next(Request& request);
+
+  // bytes received after the last request returned by next(): the beginning of the next one
+  size_t buffered() const {
+    return received - parsed;
+  }
+
+private:
+  Status parse_head(const char* begin, const char* end, Request& request) const;
+
+  std::vector<char, PoolAllocator<char>> buffer;  // recycled between connections of a thread
+  size_t parsed = 0;     // requests before this offset are already returned by next()
+  size_t received = 0;   // end of received data
+  size_t scanned = 0;    // no end of header before this offset
+  size_t head_size = 0;  // head of the request at parsed when it waits for its body, 0 otherwise
+  size_t body_size = 0;  // Content-Length of that request
+};
@@ -1,73 +1,94 @@
 #include "response.hpp"
-#include "windows.h"
-#include <chrono>
-#include <ctime>
+#include "assets.hpp"
+#include "cache_policy.hpp"
+#include "compress.hpp"
+#include "http_date.hpp"
+#include "metrics.hpp"
+#include "page_template.hpp"
+#include "request.hpp"
+#include "router.hpp"
+#include <fmt/format.h>
+#include <algorithm>
+#include <charconv>
 #include <array>
-#include <functional>
+#include <atomic>
+#include <cstdio>
+#include <iterator>
+#include <utility>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 using namespace std;
 
-tuple<string_view, const char*> tokenize(const char* data, const char* data_end, char stop_char) {
-  auto end = std::find(data, data_end, stop_char);
-  return { end == data_end ? string_view{} : string_view{ data, size_t(end - data) }, end };
+FileRegion::FileRegion(FileRegion&& other) noexcept : fd_(std::exchange(other.fd_, -1)), size_(other.size_) {
 }
 
-tuple<string_view, string_view, string_view> get_request(const char* data, size_t size) {
-  // do not check whether request is valid
-  auto data_end = data + size;
-  auto [method, method_end] = tokenize(data, data_end, ' ');
-  auto [url, url_end] = tokenize(method_end + 1, data_end, ' ');
-  auto [protocol, prot_end] = tokenize(url_end + 1, data_end, '\r');
-  return { method, url, protocol };
+FileRegion& FileRegion::operator=(FileRegion&& other) noexcept {
+  if (this != &other) {
+    close();
+    fd_ = std::exchange(other.fd_, -1);
+    size_ = other.size_;
+  }
+  return *this;
 }
 
-std::vector<char> from_resource(int id) {
-  HMODULE hModule = NULL;
-  GetModuleHandleEx(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS, (LPCTSTR)&from_resource, &hModule);
-  if (HRSRC fr = FindResourceA(hModule, MAKEINTRESOURCEA(id), "DAT")) {
-    auto rsize = SizeofResource(hModule, fr);
-    if (auto res = LoadResource(hModule, fr))
-      if (const char* resource = (const char*)LockResource(res))
-        return std::vector<char>(resource, resource + rsize);
-  }
-  return {};
-}
-
-string current_time_str() {
-  using namespace std::chrono;
-  std::time_t now = system_clock::to_time_t(system_clock::now());
-  struct tm ptmTemp;
-  std::array<char, 60> buffer;
-
-  if (_gmtime64_s(&ptmTemp, &now) || !strftime(buffer.data(), buffer.size(), "%a, %d %b %Y %T GMT", &ptmTemp))
-    buffer[0] = '\0';
-  return string(buffer.data());
-}
-
-std::vector<char> replace_placeholders(const char* text, std::function<string(string_view)> replacer) {
-  auto beg = text;
-  auto end = strchr(beg, '\0');
-  std::vector<char> page;
-  while (true) {
-    auto placeholder = std::find(beg, end, '%');
-    page.insert(page.end(), beg, placeholder);
-    if (placeholder == end)
-      break;
-    ++placeholder;
-    auto placeholder_end = std::find(placeholder, end, '%');
-    if (placeholder_end == end)
-      break;
-    beg = placeholder_end + 1;
-    string_view ph(placeholder, size_t(placeholder_end - placeholder));
-    string subst = replacer(ph);
-    page.insert(page.end(), subst.begin(), subst.end());
-  }
-  return page;
+void FileRegion::reset(int fd, uint64_t size) {
+  close();
+  fd_ = fd;
+  size_ = size;
+}
+
+void FileRegion::close() {
+#ifndef _WIN32
+  if (fd_ >= 0)
+    ::close(fd_);
+#endif
+  fd_ = -1;
+  size_ = 0;
+}
+
+std::string_view Response::header_view() const {
+  if (asset)
+    return not_modified ? asset->not_modified_header : asset->header;
+  return header;
 }
 
+std::string_view Response::body_view() const {
+  if (head_only)
+    return {};
+  if (asset)
+    return not_modified ? std::string_view{} : asset->body;
+  return { content.data(), content.size() };
+}
+
+enum class PageSlot { time, table, url };
+
+void append_current_time(std::vector<char>& out) {
+  std::array<char, date_field_size> field;
+  copy_date_field(field.data());
+  append(out, date_from_field({ field.data(), field.size() }));
+}
+
+void append_number(std::vector<char>& out, int number) {
+  std::array<char, 16> buffer;
+  auto [end, ec] = std::to_chars(buffer.data(), buffer.data() + buffer.size(), number);
+  append(out, { buffer.data(), size_t(end - buffer.data()) });
+}
+
+// renders the page into out, compressed if the client accepts gzip
+template <class Slot, class F>
+void render_page(const PageTemplate<Slot>& page, std::vector<char>& out, Encoding encoding, F&& fill) {
+  if (encoding == Encoding::gzip)
+    page.render_gzip(out, fill);
+  else
+    page.render(out, fill);
+}
 
-std::vector<char> root_page() {
-  const char* root_html = R"(
+void root_page(std::vector<char>& out, Encoding encoding) {
+  static const PageTemplate<PageSlot> page{ R"(
   <html>
     <header>
       <title>Right way</title>
@@ -78,11 +99,11 @@ std::vector<char> root_page() {
       <p>Go to <a href="/many_photos">many photos</a> page.</p>
       <a href="/photo.jpg"><img src="/photo.jpg" width="600" height="325" /></a>
     <body>
-  </html>)";
-  return replace_placeholders(root_html, [](string_view ph) { return ph == "time" ? current_time_str() : string{}; });
+  </html>)", { { "time", PageSlot::time } } };
+  render_page(page, out, encoding, [](PageSlot, std::vector<char>& out) { append_current_time(out); });
 }
 
-string create_table(int cols, int rows) {
+void create_table(std::vector<char>& out, int cols, int rows) {
   /*
       <table cellspacing="5">
         <tr>
@@ -96,23 +117,46 @@ string create_table(int cols, int rows) {
         ...
       </table>
   */
+  enum class CellSlot { number };
+  static const PageTemplate<CellSlot> cell{
+    R"(<td><a href = "/photo%n%.jpg"><img src = "/photo%n%.jpg" width="100" height="55" alt="photo%n%"></a></td>)",
+    { { "n", CellSlot::number } } };
+  constexpr string_view table_begin = R"(<table cellspacing = "5">)";
+  constexpr string_view table_end = R"(</table>)";
+  constexpr string_view row_begin = R"(<tr>)";
+  constexpr string_view row_end = R"(</tr>)";
+  constexpr size_t max_number_size = 5 * 3;  // three numbers up to 99999 per cell
+
+  out.reserve(out.size() + table_begin.size() + table_end.size() +
+    size_t(rows) * (row_begin.size() + row_end.size() + size_t(cols) * (cell.static_size() + max_number_size)));
   int photo_num = 1;
-  string table = R"(<table cellspacing = "5">)";
+  append(out, table_begin);
   for (int row = 0; row < rows; ++row) {
-    table += R"(<tr>)";
-    for (int col = 0; col < cols; ++col) {
-      string num_str = std::to_string(photo_num++);
-      table = table + R"(<td><a href = "/photo)" + num_str + R"(.jpg"><img src = "/photo)" +
-        num_str + R"(.jpg" width="100" height="55" alt="photo)" + num_str + R"("></a></td>)";
+    append(out, row_begin);
+    for (int col = 0; col < cols; ++col, ++photo_num)
+      cell.render(out, [photo_num](CellSlot, std::vector<char>& out) { append_number(out, photo_num); });
+    append(out, row_end);
+  }
+  append(out, table_end);
+}
+
+// value of an integer query parameter limited to [1, max_value], default_value if absent or invalid
+int query_param(string_view query, string_view name, int default_value, int max_value) {
+  while (!query.empty()) {
+    auto item = query.substr(0, query.find('&'));
+    query.remove_prefix(std::min(query.size(), item.size() + 1));
+    if (item.size() > name.size() && item.starts_with(name) && item[name.size()] == '=') {
+      int value = 0;
+      auto [end, ec] = std::from_chars(item.data() + name.size() + 1, item.data() + item.size(), value);
+      if (ec == std::errc{} && value > 0)
+        return std::min(value, max_value);
     }
-    table += R"(</tr>)";
   }
-  table += R"(</table>)";
-  return table;
+  return default_value;
 }
 
-std::vector<char> root_page2() {
-  const char* root_html = R"(
+void root_page2(std::vector<char>& out, string_view query, Encoding encoding) {
+  static const PageTemplate<PageSlot> page{ R"(
   <html>
     <header>
       <title>Right way</title>
@@ -123,13 +167,20 @@ std::vector<char> root_page2() {
       <p>Go to <a href="/">root</a> page.</p>
       %table%
     <body>
-  </html>)";
-  return replace_placeholders(root_html, [](string_view ph) {
-    return ph == "time" ? current_time_str() : ph == "table" ? create_table(6, 6) : string{}; });
+  </html>)", { { "time", PageSlot::time }, { "table", PageSlot::table } } };
+  constexpr int max_side = 100;
+  int cols = query_param(query, "cols", 6, max_side);
+  int rows = query_param(query, "rows", 6, max_side);
+  render_page(page, out, encoding, [cols, rows](PageSlot slot, std::vector<char>& out) {
+    if (slot == PageSlot::time)
+      append_current_time(out);
+    else
+      create_table(out, cols, rows);
+  });
 }
 
-std::vector<char> not_found_page(string_view url) {
-  const char* html = R"(
+void not_found_page(std::vector<char>& out, string_view url, Encoding encoding) {
+  static const PageTemplate<PageSlot> page{ R"(
   <html>
     <header>
       <title>Not found</title>
@@ -139,46 +190,285 @@ std::vector<char> not_found_page(string_view url) {
       <p>The requested URL <b>%page%</b> does not exist.</p>
       <p>Go to <a href="/">root</a> page.</p>
     <body>
-  </html>)";
-  return replace_placeholders(html, [url](string_view ph) { return ph == "page" ? string{ url } : string{}; });
+  </html>)", { { "page", PageSlot::url } } };
+  render_page(page, out, encoding, [url](PageSlot, std::vector<char>& out) { append(out, url); });
 }
 
-std::vector<char> form_answer(string_view method, string_view url, string_view protocol) {
-  std::vector<char> content;
-  string content_type;
-  string result = "200 OK";
-  if (url == "/") {
-    content = root_page();
-    content_type = "text/html";
-  }
-  else if (url == "/many_photos") {
-    content = root_page2();
-    content_type = "text/html";
+// set when the server starts draining, read by every response
+std::atomic<bool> draining{ false };
+
+// per-request fields go last, so the empty line ending the header goes with them
+void set_tail(Response& response, string_view protocol) {
+  constexpr string_view keep_alive = "Connection:keep-alive\r\n";
+  constexpr string_view close = "Connection:close\r\n";
+  constexpr string_view end = "\r\n";
+  static_assert(date_field_size + keep_alive.size() + end.size() <= sizeof(Response::tail));
+  auto& tail = response.tail;
+  copy_date_field(tail.data());
+  auto pos = tail.data() + date_field_size;
+  // a keep-alive client learns from this response that the connection is closed after it
+  if (draining.load(std::memory_order_relaxed))
+    response.keep_alive = false;
+  if (!response.keep_alive)
+    pos = std::copy(close.begin(), close.end(), pos);
+  else if (protocol == "HTTP/1.0")
+    pos = std::copy(keep_alive.begin(), keep_alive.end(), pos);
+  pos = std::copy(end.begin(), end.end(), pos);
+  response.tail_size = size_t(pos - tail.data());
+}
+
+void set_draining() {
+  draining.store(true, std::memory_order_relaxed);
+}
+
+string files_root;
+
+void set_files_root(string_view dir) {
+  files_root = dir;
+}
+
+string_view content_type_of(string_view name) {
+  constexpr std::pair<string_view, string_view> types[] = { { ".html", "text/html" }, { ".htm", "text/html" },
+    { ".txt", "text/plain" }, { ".css", "text/css" }, { ".js", "text/javascript" }, { ".json", "application/json" },
+    { ".jpg", "image/jpeg" }, { ".jpeg", "image/jpeg" }, { ".png", "image/png" }, { ".gif", "image/gif" },
+    { ".ico", "image/x-icon" }, { ".svg", "image/svg+xml" } };
+  for (auto& [extension, type] : types)
+    if (name.ends_with(extension))
+      return type;
+  return "application/octet-stream";
+}
+
+// the file was truncated while read or reading failed: the tag and length of the file are no
+// longer known to match any content
+void form_read_error(Response& response) {
+  response.content.clear();
+  response.header =
+    "HTTP/1.1 500 Internal Server Error\r\n"
+    "Content-Length:0\r\n"
+    "Cache-Control:no-store\r\n";
+}
+
+// serves a file from files_root: 304 if the client's copy is current, small files are read into
+// content, larger ones are left open to be sent with sendfile; returns false if there's no such file
+bool serve_file(string_view name, const Request& request, Response& response) {
+  // bodies below this size are cheaper to copy than to send with a separate syscall
+  constexpr uint64_t sendfile_threshold = 64 * 1024;
+  if (files_root.empty() || name.empty() || name.find("..") != name.npos || name.find('\\') != name.npos)
+    return false;
+  static thread_local string path;  // keeps its capacity between requests
+  path.assign(files_root).append(1, '/').append(name);
+#ifdef _WIN32
+  struct _stat64 st;
+  if (_stat64(path.c_str(), &st) || !(st.st_mode & _S_IFREG))
+    return false;
+#else
+  // O_NONBLOCK: opening a FIFO for reading would otherwise block the thread until a writer comes;
+  // it's rejected below, and on regular files the flag has no effect on pread or sendfile
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC | O_NONBLOCK);
+  if (fd < 0)
+    return false;
+  struct stat st;
+  if (::fstat(fd, &st) || !S_ISREG(st.st_mode)) {
+    ::close(fd);
+    return false;
   }
-  else if (url == "/favicon.ico") {
-    content = from_resource(101);
-    content_type = "image/x-icon";
+#endif
+  uint64_t size = uint64_t(st.st_size);
+  std::time_t modified = st.st_mtime;
+
+  // changes whenever the file is replaced, resized or modified. The modification time has a
+  // resolution of seconds on Windows, where two writes within a second may keep the same tag,
+  // so it's a weak one there
+  std::array<char, 80> etag_buffer;
+#ifdef _WIN32
+  auto etag_end = fmt::format_to_n(etag_buffer.data(), etag_buffer.size(), "W/\"{:x}-{:x}\"", modified, size).out;
+#else
+  auto etag_end = fmt::format_to_n(etag_buffer.data(), etag_buffer.size(), "\"{:x}-{:x}.{:x}-{:x}\"",
+    uint64_t(st.st_ino), modified, uint64_t(st.st_mtim.tv_nsec), size).out;
+#endif
+  string_view etag{ etag_buffer.data(), size_t(etag_end - etag_buffer.data()) };
+  // If-None-Match uses the weak comparison
+  auto opaque_etag = etag.starts_with("W/") ? etag.substr(2) : etag;
+  std::array<char, http_date_size + 1> last_modified;
+  if (!format_http_date(modified, last_modified.data()))
+    last_modified[0] = '\0';
+  auto it = std::back_inserter(response.header);
+
+  if (is_not_modified(request, opaque_etag, modified)) {
+#ifndef _WIN32
+    ::close(fd);
+#endif
+    fmt::format_to(it, "HTTP/1.1 304 Not Modified\r\n{}ETag:{}\r\nLast-Modified:{}\r\n",
+      cache_control_field(CacheClass::files), etag, last_modified.data());
+    return true;
   }
-  else if (url.starts_with("/photo") && url.ends_with(".jpg")) {
-    content = from_resource(102);
-    content_type = "image/jpeg";
+
+#ifdef _WIN32
+  std::FILE* file = nullptr;
+  if (fopen_s(&file, path.c_str(), "rb") || !file)
+    return false;
+  response.content.resize(size);
+  auto done = std::fread(response.content.data(), 1, response.content.size(), file);
+  std::fclose(file);
+  if (done != size) {
+    form_read_error(response);
+    return true;
   }
+#else
+  if (size >= sendfile_threshold)
+    response.file.reset(fd, size);
   else {
-    content = not_found_page(url);
-    content_type = "text/html";
-    result = "404 NotFound";
+    response.content.resize(size);
+    size_t done = 0;
+    while (done < size) {
+      auto res = ::pread(fd, response.content.data() + done, size - done, off_t(done));
+      if (res <= 0)
+        break;
+      done += size_t(res);
+    }
+    ::close(fd);
+    if (done != size) {
+      form_read_error(response);
+      return true;
+    }
   }
+#endif
+  fmt::format_to(it,
+    "HTTP/1.1 200 OK\r\n"
+    "Content-Length:{}\r\n"
+    "Content-Type:{}\r\n"
+    "{}ETag:{}\r\nLast-Modified:{}\r\n",
+    size, content_type_of(name), cache_control_field(CacheClass::files), etag, last_modified.data());
+  return true;
+}
+
+// fields of the dynamic pages; they all depend on Accept-Encoding
+void set_page_header(Response& response, string_view status, string_view cache_control, string_view content_type,
+  Encoding encoding) {
+  fmt::format_to(std::back_inserter(response.header),
+    "HTTP/1.1 {}\r\n"
+    "{}"
+    "Content-Length:{}\r\n"
+    "Content-Type:{}\r\n"
+    "{}Vary:Accept-Encoding\r\n",
+    status, cache_control, response.content.size(), content_type,
+    encoding == Encoding::gzip ? "Content-Encoding:gzip\r\n" : "");
+}
+
+// static assets are served from memory with precomputed headers, compressed ones if accepted
+void serve_asset(const RouteContext& context, Response& response, AssetId id) {
+  auto& asset = get_asset(id);
+  response.asset = context.encoding == Encoding::gzip && asset.has_gzip() ? &asset.gzip : &asset.identity;
+  response.not_modified = is_not_modified(context.request, response.asset->etag, asset.last_modified);
+}
+
+void form_not_found(const RouteContext& context, Response& response) {
+  response.route = Route::not_found;
+  not_found_page(response.content, context.request.url, context.encoding);
+  set_page_header(response, "404 NotFound", cache_control_field(CacheClass::pages), "text/html", context.encoding);
+}
+
+void form_method_not_allowed(unsigned allowed, Response& response) {
+  response.route = Route::method_not_allowed;
+  auto it = std::back_inserter(response.header);
+  fmt::format_to(it, "HTTP/1.1 405 Method Not Allowed\r\nAllow:");
+  string_view separator;
+  for (size_t i = 0; i < size_t(HttpMethod::count); ++i)
+    if (allowed & (1u << i)) {
+      fmt::format_to(it, "{}{}", separator, method_name(HttpMethod(i)));
+      separator = ", ";
+    }
+  fmt::format_to(it, "\r\nContent-Length:0\r\n");
+}
+
+// built once at startup by set_router(), then only read
+Router routes;
+
+void add_default_routes(Router& router) {
+  auto pages_cache = [] { return cache_control_field(CacheClass::pages); };
+  router.add(HttpMethod::get, "/", "root", [pages_cache](const RouteContext& context, Response& response) {
+    root_page(response.content, context.encoding);
+    set_page_header(response, "200 OK", pages_cache(), "text/html", context.encoding);
+  });
+  router.add(HttpMethod::get, "/many_photos", "gallery",
+    [pages_cache](const RouteContext& context, Response& response) {
+      root_page2(response.content, context.query, context.encoding);
+      set_page_header(response, "200 OK", pages_cache(), "text/html", context.encoding);
+    });
+  router.add(HttpMethod::get, "/favicon.ico", "favicon", [](const RouteContext& context, Response& response) {
+    serve_asset(context, response, AssetId::favicon);
+  });
+  // every /photo{n}.jpg of the gallery is the same picture
+  router.add(HttpMethod::get, "/photo{n}.jpg", "photo", [](const RouteContext& context, Response& response) {
+    serve_asset(context, response, AssetId::photo);
+  });
+  router.add(HttpMethod::get, "/files/{name*}", "files", [](const RouteContext& context, Response& response) {
+    if (!serve_file(context.params["name"], context.request, response))
+      form_not_found(context, response);
+  });
+  router.add(HttpMethod::get, "/metrics", "metrics", [](const RouteContext& context, Response& response) {
+    if (context.encoding == Encoding::gzip) {
+      auto& scratch = GzipWriter::scratch();
+      scratch.clear();
+      render_metrics(scratch);
+      GzipWriter writer{ response.content };
+      writer.compress({ scratch.data(), scratch.size() });
+      writer.finish();
+    }
+    else
+      render_metrics(response.content);
+    set_page_header(response, "200 OK", "Cache-Control:no-cache\r\n", "text/plain; version=0.0.4", context.encoding);
+  });
+}
+
+void set_router(Router router) {
+  routes = std::move(router);
+  routes.build();
+  set_route_names(routes.route_names());
+}
+
+void form_answer(const Request& request, Response& response) {
+  auto url = request.url;
+  auto path = url.substr(0, url.find('?'));
+  auto query = path.size() < url.size() ? url.substr(path.size() + 1) : string_view{};
+  response.asset = nullptr;
+  response.not_modified = false;
+  response.head_only = false;
+  response.header.clear();
+  response.content.clear();
+  response.file.close();
+  response.keep_alive = request.keep_alive;
+  set_tail(response, request.protocol);
+
+  RouteContext context{ request, path, query, negotiate_encoding(request.header("Accept-Encoding")), {} };
+  auto method = parse_method(request.method);
+  auto match = routes.find(method, path, context.params);
+  if (match.handler) {
+    response.route = match.route;
+    (*match.handler)(context, response);
+  }
+  else if (match.allowed)
+    form_method_not_allowed(match.allowed, response);
+  else
+    form_not_found(context, response);
+  // HEAD is answered by the GET handler: its Content-Length stays, the body is dropped
+  if (method == HttpMethod::head) {
+    response.head_only = true;
+    response.content.clear();
+    response.file.close();
+  }
+}
 
-  string header =
-    string{ protocol } +" " + result + "\r\n"
-    "Cache-Control:no-cache\r\n"
-    "Content-Length:" + std::to_string(content.size()) + "\r\n"
-    "Content-Type:" + content_type + "\r\n"
-    "Date:" + current_time_str() + "\r\n"
-    "\r\n";
-
-  std::vector<char> answer;
-  answer.insert(answer.end(), header.begin(), header.end());
-  answer.insert(answer.end(), content.begin(), content.end());
-  return answer;
+void form_bad_request(Response& response) {
+  response.asset = nullptr;
+  response.not_modified = false;
+  response.head_only = false;
+  response.content.clear();
+  response.file.close();
+  response.keep_alive = false;
+  response.route = Route::bad_request;
+  set_tail(response, {});
+  response.header =
+    "HTTP/1.1 400 Bad Request\r\n"
+    "Content-Length:0\r\n";
 }
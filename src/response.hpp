@@ -1,10 +1,81 @@
 #pragma once
-#include <tuple>
+#include "router.hpp"
+#include <array>
+#include <cstdint>
 #include <string>
 #include <string_view>
 #include <vector>
 
-// returns {method, url, protocol}
-std::tuple<std::string_view, std::string_view, std::string_view> get_request(const char* data, size_t size);
+struct AssetVariant;
+struct Request;
 
-std::vector<char> form_answer(std::string_view method, std::string_view url, std::string_view protocol);
+// open file whose contents are sent as the body with sendfile, closed on destruction
+class FileRegion
+{
+public:
+  FileRegion() = default;
+  FileRegion(const FileRegion&) = delete;
+  FileRegion& operator=(const FileRegion&) = delete;
+  FileRegion(FileRegion&& other) noexcept;
+  FileRegion& operator=(FileRegion&& other) noexcept;
+  ~FileRegion() {
+    close();
+  }
+
+  void reset(int fd, uint64_t size);
+  void close();
+  bool is_open() const {
+    return fd_ >= 0;
+  }
+  int fd() const {
+    return fd_;
+  }
+  uint64_t size() const {
+    return size_;
+  }
+
+private:
+  int fd_ = -1;
+  uint64_t size_ = 0;
+};
+
+// response is sent as header (without per-request fields), tail and body; the body is
+// either in memory (content or a borrowed preloaded asset) or a file region
+struct Response {
+  const AssetVariant* asset = nullptr;  // preloaded asset sent as is, header and content are unused then
+  bool not_modified = false;             // asset is answered with its precomputed 304 header and no body
+  bool head_only = false;                // HEAD request: the header is sent as for GET, the body is not
+  std::string header;                    // reused between requests of a connection
+  std::vector<char> content;             // reused between requests of a connection
+  FileRegion file;                       // file body, sent after header and tail when open
+  std::array<char, 80> tail;  // cached Date field, optional Connection field and the empty line
+  size_t tail_size = 0;
+  bool keep_alive = true;
+  Route route = Route::not_found;
+
+  std::string_view header_view() const;
+  std::string_view body_view() const;
+  std::string_view tail_view() const {
+    return { tail.data(), tail_size };
+  }
+};
+
+// registers the built-in routes: /, /many_photos, /favicon.ico, /photo{n}.jpg, /files/{name*}, /metrics
+void add_default_routes(Router& router);
+
+// builds the route table used by form_answer; call once at startup, before requests are served
+void set_router(Router router);
+
+// fills response for the request with the handler of its route, 404 or 405 if there's none;
+// response buffers are reused, so a connection can keep its Response objects between requests
+void form_answer(const Request& request, Response& response);
+
+// every response formed from now on has Connection:close and keep_alive false: the server is
+// draining, so the connections close after their current requests
+void set_draining();
+
+// directory served under /files/, empty (default) disables the route
+void set_files_root(std::string_view dir);
+
+// answer to a request that can't be parsed; connection is closed after it
+void form_bad_request(Response& response);
@@ -0,0 +1,273 @@
+#include "router.hpp"
+#include <fmt/format.h>
+#include <algorithm>
+#include <bit>
+#include <map>
+#include <stdexcept>
+
+namespace {
+
+constexpr std::string_view method_names[] = { "GET", "HEAD", "POST", "PUT", "DELETE", "OPTIONS", "PATCH" };
+static_assert(std::size(method_names) == size_t(HttpMethod::count));
+
+// FNV-1a
+uint64_t hash_path(std::string_view path) {
+  uint64_t hash = 0xcbf29ce484222325;
+  for (char c : path)
+    hash = (hash ^ uint8_t(c)) * 0x100000001b3;
+  return hash;
+}
+
+// index in a power of two table for a path hash and a seed, mixed with the murmur3 finalizer
+uint32_t slot_of(uint64_t hash, uint32_t seed, size_t table_size) {
+  uint64_t x = hash ^ (uint64_t(seed) * 0x9e3779b97f4a7c15);
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccd;
+  x ^= x >> 33;
+  return uint32_t(x & (table_size - 1));
+}
+
+}  // namespace
+
+HttpMethod parse_method(std::string_view method) {
+  auto it = std::find(std::begin(method_names), std::end(method_names), method);
+  return HttpMethod(it - std::begin(method_names));
+}
+
+std::string_view method_name(HttpMethod method) {
+  return method < HttpMethod::count ? method_names[size_t(method)] : std::string_view{};
+}
+
+std::string_view RouteParams::operator[](std::string_view name) const {
+  for (size_t i = 0; i < count; ++i)
+    if (names[i] == name)
+      return values[i];
+  return {};
+}
+
+Route Router::add(HttpMethod method, std::string_view pattern, std::string_view name, RouteHandler handler) {
+  if (method >= HttpMethod::count || !pattern.starts_with('/'))
+    throw std::invalid_argument("bad route " + std::string(pattern));
+  Entry parsed;
+  auto brace = pattern.find('{');
+  parsed.prefix = pattern.substr(0, brace);
+  for (auto rest = pattern.substr(parsed.prefix.size()); !rest.empty();) {
+    auto close = rest.find('}');
+    if (close == rest.npos || parsed.params.size() == RouteParams::max_params)
+      throw std::invalid_argument("bad route " + std::string(pattern));
+    auto& param = parsed.params.emplace_back();
+    param.name = rest.substr(1, close - 1);
+    param.rest = param.name.ends_with('*');
+    if (param.rest)
+      param.name.pop_back();
+    rest.remove_prefix(close + 1);
+    param.literal = rest.substr(0, rest.find('{'));
+    rest.remove_prefix(param.literal.size());
+    // a parameter must be delimited by a literal, {name*} must be last
+    if (param.name.empty() || param.name.find_first_of("{*") != param.name.npos ||
+      (param.literal.empty() && !rest.empty()) || (param.rest && !(param.literal.empty() && rest.empty())))
+      throw std::invalid_argument("bad route " + std::string(pattern));
+  }
+
+  auto same_pattern = [&](const Entry& entry) {
+    return entry.prefix == parsed.prefix && std::equal(entry.params.begin(), entry.params.end(),
+      parsed.params.begin(), parsed.params.end(), [](const Param& a, const Param& b) {
+        return a.name == b.name && a.rest == b.rest && a.literal == b.literal;
+      });
+  };
+  auto it = std::find_if(entries.begin(), entries.end(), same_pattern);
+  auto& entry = it != entries.end() ? *it : entries.emplace_back(std::move(parsed));
+  auto& slot = entry.handlers[size_t(method)];
+  if (slot)
+    throw std::invalid_argument(fmt::format("{} {} is already routed", method_name(method), pattern));
+  auto named = std::find(names.begin(), names.end(), name);
+  if (named == names.end())
+    named = names.emplace(names.end(), name);
+  auto route = Route(named - names.begin());
+  handlers.push_back({ route, std::move(handler) });
+  slot = uint32_t(handlers.size());
+  return route;
+}
+
+void Router::build() {
+  std::vector<uint32_t> exact;
+  std::vector<uint32_t> patterns;
+  for (uint32_t i = 0; i < entries.size(); ++i)
+    (entries[i].params.empty() ? exact : patterns).push_back(i);
+  build_exact(exact);
+  build_trie(patterns);
+}
+
+void Router::build_exact(const std::vector<uint32_t>& exact) {
+  seeds.clear();
+  slots.clear();
+  if (exact.empty())
+    return;
+  std::vector<uint64_t> hashes(entries.size());
+  for (auto i : exact)
+    hashes[i] = hash_path(entries[i].prefix);
+  // at most half of the slots are used, so seeds are found after a few tries
+  for (size_t slot_count = std::bit_ceil(exact.size() * 2);; slot_count *= 2) {
+    std::vector<std::vector<uint32_t>> buckets(std::bit_ceil(std::max<size_t>(exact.size() / 2, 1)));
+    for (auto i : exact)
+      buckets[slot_of(hashes[i], 0, buckets.size())].push_back(i);
+    std::vector<uint32_t> order(buckets.size());
+    for (uint32_t i = 0; i < order.size(); ++i)
+      order[i] = i;
+    // larger buckets are placed first, while there are more free slots
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+      return buckets[a].size() > buckets[b].size();
+    });
+    seeds.assign(buckets.size(), 0);
+    slots.assign(slot_count, 0);
+    bool placed = true;
+    for (auto b : order) {
+      auto& bucket = buckets[b];
+      if (bucket.empty())
+        break;
+      constexpr uint32_t max_seed = 1 << 16;
+      uint32_t seed = 1;
+      for (; seed < max_seed; ++seed) {
+        std::vector<uint32_t> taken;
+        bool fits = true;
+        for (auto i : bucket) {
+          auto slot = slot_of(hashes[i], seed, slot_count);
+          if (slots[slot] || std::find(taken.begin(), taken.end(), slot) != taken.end()) {
+            fits = false;
+            break;
+          }
+          taken.push_back(slot);
+        }
+        if (fits)
+          break;
+      }
+      if (seed == max_seed) {
+        placed = false;
+        break;
+      }
+      seeds[b] = seed;
+      for (auto i : bucket)
+        slots[slot_of(hashes[i], seed, slot_count)] = i + 1;
+    }
+    if (placed)
+      return;
+  }
+}
+
+void Router::build_trie(const std::vector<uint32_t>& patterns) {
+  nodes.clear();
+  edge_chars.clear();
+  edge_nodes.clear();
+  node_patterns.clear();
+  if (patterns.empty())
+    return;
+  struct BuildNode {
+    std::map<char, uint32_t> children;
+    std::vector<uint32_t> patterns;
+  };
+  std::vector<BuildNode> tree(1);
+  for (auto i : patterns) {
+    uint32_t node = 0;
+    for (char c : entries[i].prefix) {
+      auto [it, inserted] = tree[node].children.try_emplace(c, uint32_t(tree.size()));
+      node = it->second;
+      if (inserted)
+        tree.emplace_back();
+    }
+    tree[node].patterns.push_back(i);
+  }
+  // breadth-first, so the edges of a node are contiguous
+  std::vector<uint32_t> order{ 0 };
+  nodes.resize(tree.size());
+  for (size_t i = 0; i < order.size(); ++i) {
+    auto& source = tree[order[i]];
+    auto& node = nodes[i];
+    node.first_edge = uint32_t(edge_chars.size());
+    node.edge_count = uint32_t(source.children.size());
+    for (auto [c, child] : source.children) {
+      nodes[order.size()].parent = uint32_t(i);
+      edge_chars.push_back(c);
+      edge_nodes.push_back(uint32_t(order.size()));
+      order.push_back(child);
+    }
+    node.first_pattern = uint32_t(node_patterns.size());
+    node.pattern_count = uint32_t(source.patterns.size());
+    node_patterns.insert(node_patterns.end(), source.patterns.begin(), source.patterns.end());
+  }
+}
+
+bool Router::match_params(const Entry& entry, std::string_view rest, RouteParams& params) const {
+  params.count = 0;
+  for (size_t i = 0; i < entry.params.size(); ++i) {
+    auto& param = entry.params[i];
+    size_t end = rest.size();
+    if (!param.rest) {
+      if (i + 1 < entry.params.size())
+        end = rest.find(param.literal);
+      else if (rest.ends_with(param.literal))
+        end = rest.size() - param.literal.size();
+      else
+        return false;
+      if (end == rest.npos || rest.substr(0, end).find('/') != rest.npos)
+        return false;
+    }
+    params.names[params.count] = param.name;
+    params.values[params.count++] = rest.substr(0, end);
+    rest.remove_prefix(end + param.literal.size());
+  }
+  return rest.empty();
+}
+
+Router::Match Router::select(const Entry& entry, HttpMethod method) const {
+  uint32_t index = method < HttpMethod::count ? entry.handlers[size_t(method)] : 0;
+  if (!index && method == HttpMethod::head)
+    index = entry.handlers[size_t(HttpMethod::get)];
+  if (index) {
+    auto& handler = handlers[index - 1];
+    return { &handler.handler, handler.route };
+  }
+  Match match;
+  for (size_t i = 0; i < entry.handlers.size(); ++i)
+    if (entry.handlers[i])
+      match.allowed |= 1u << i;
+  if (entry.handlers[size_t(HttpMethod::get)])
+    match.allowed |= 1u << size_t(HttpMethod::head);
+  return match;
+}
+
+Router::Match Router::find(HttpMethod method, std::string_view path, RouteParams& params) const {
+  params.count = 0;
+  if (!slots.empty()) {
+    auto hash = hash_path(path);
+    auto seed = seeds[slot_of(hash, 0, seeds.size())];
+    if (auto index = slots[slot_of(hash, seed, slots.size())]; index && entries[index - 1].prefix == path)
+      return select(entries[index - 1], method);
+  }
+  if (nodes.empty())
+    return {};
+  // down the trie as far as the path goes, then back up trying the patterns of each prefix
+  uint32_t node = 0;
+  size_t depth = 0;
+  for (; depth < path.size(); ++depth) {
+    auto begin = edge_chars.begin() + nodes[node].first_edge;
+    auto end = begin + nodes[node].edge_count;
+    auto it = std::lower_bound(begin, end, path[depth]);
+    if (it == end || *it != path[depth])
+      break;
+    node = edge_nodes[size_t(it - edge_chars.begin())];
+  }
+  while (true) {
+    auto& current = nodes[node];
+    for (uint32_t i = 0; i < current.pattern_count; ++i) {
+      auto& entry = entries[node_patterns[current.first_pattern + i]];
+      if (match_params(entry, path.substr(depth), params))
+        return select(entry, method);
+    }
+    if (node == 0)
+      break;
+    node = current.parent;
+    --depth;
+  }
+  params.count = 0;
+  return {};
+}
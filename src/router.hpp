@@ -0,0 +1,124 @@
+#pragma once
+#include "compress.hpp"
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+struct Request;
+struct Response;
+
+// requests are counted per route in the metrics: fixed ids for the requests no route handles,
+// followed by one id per name given to Router::add()
+enum class Route : uint32_t { not_found, method_not_allowed, bad_request };
+
+enum class HttpMethod { get, head, post, put, delete_, options, patch, count };
+
+// HttpMethod::count for a method the router doesn't know
+HttpMethod parse_method(std::string_view method);
+std::string_view method_name(HttpMethod method);
+
+// values of the {name} parameters of the matched pattern
+class RouteParams
+{
+public:
+  static constexpr size_t max_params = 4;
+
+  // value of the parameter, empty if the pattern has no such parameter
+  std::string_view operator[](std::string_view name) const;
+  size_t size() const {
+    return count;
+  }
+
+private:
+  friend class Router;
+
+  std::array<std::string_view, max_params> names;
+  std::array<std::string_view, max_params> values;
+  size_t count = 0;
+};
+
+struct RouteContext {
+  const Request& request;
+  std::string_view path;   // url without the query
+  std::string_view query;  // after '?', empty if none
+  Encoding encoding;       // negotiated from Accept-Encoding
+  RouteParams params;
+};
+
+// fills the header (without the per-request tail) and the body of the response
+using RouteHandler = std::function<void(const RouteContext& context, Response& response)>;
+
+// route table built once at startup and only read afterwards, so it's shared by all threads.
+// Literal paths are found with a perfect hash, patterns through a trie of their literal prefixes:
+// the cost of a lookup depends on the length of the path, not on the number of routes
+class Router
+{
+public:
+  // pattern is a literal path or contains {name} parameters, each matching a run of characters
+  // other than '/' and followed by a literal (e.g. /photo{n}.jpg) or ending the pattern; a last
+  // {name*} parameter matches the rest of the path. Literal paths take precedence over patterns,
+  // longer literal prefixes over shorter ones. Throws std::invalid_argument for a malformed pattern
+  // or a method registered twice for the same pattern. name labels the route in the metrics,
+  // routes added with the same name share its id
+  Route add(HttpMethod method, std::string_view pattern, std::string_view name, RouteHandler handler);
+  // prepares the lookup structures, call after the last add()
+  void build();
+
+  // names of the route ids, the fixed ones first, indexed by Route
+  const std::vector<std::string>& route_names() const {
+    return names;
+  }
+
+  struct Match {
+    const RouteHandler* handler = nullptr;
+    Route route = Route::not_found;
+    unsigned allowed = 0;  // bits of the methods the path has handlers for, set when handler is null
+  };
+  // HEAD is answered by the GET handler unless it has its own
+  Match find(HttpMethod method, std::string_view path, RouteParams& params) const;
+
+private:
+  struct Param {
+    std::string name;
+    bool rest = false;    // {name*}
+    std::string literal;  // follows the parameter
+  };
+  struct Entry {
+    std::string prefix;  // the whole path for literal routes
+    std::vector<Param> params;
+    std::array<uint32_t, size_t(HttpMethod::count)> handlers{};  // index + 1 in handlers, 0 if none
+  };
+  struct Handler {
+    Route route;
+    RouteHandler handler;
+  };
+  struct Node {
+    uint32_t parent = 0;
+    uint32_t first_edge = 0;
+    uint32_t edge_count = 0;
+    uint32_t first_pattern = 0;
+    uint32_t pattern_count = 0;
+  };
+
+  bool match_params(const Entry& entry, std::string_view rest, RouteParams& params) const;
+  Match select(const Entry& entry, HttpMethod method) const;
+  void build_exact(const std::vector<uint32_t>& exact);
+  void build_trie(const std::vector<uint32_t>& patterns);
+
+  std::vector<Entry> entries;
+  std::vector<Handler> handlers;
+  std::vector<std::string> names{ "not_found", "method_not_allowed", "bad_request" };  // of the fixed ids first
+
+  // exact paths: hash and displace, the bucket of a path gives the seed placing it in its slot
+  std::vector<uint32_t> seeds;
+  std::vector<uint32_t> slots;  // entry index + 1, 0 if free
+
+  // literal prefixes of the patterns
+  std::vector<Node> nodes;
+  std::vector<char> edge_chars;       // sorted per node
+  std::vector<uint32_t> edge_nodes;
+  std::vector<uint32_t> node_patterns;  // entry indexes in order of registration
+};
@@ -0,0 +1,141 @@
+#include "timer_wheel.hpp"
+#include "allocator.hpp"
+#include "asio_pool.hpp"
+#include <algorithm>
+
+namespace {
+
+bool shared_contexts_ = false;
+
+}  // namespace
+
+void set_shared_contexts(bool shared) {
+  shared_contexts_ = shared;
+}
+
+bool shared_contexts() {
+  return shared_contexts_;
+}
+
+asio::io_context::id TimerWheel::id;
+
+TimerWheel::TimerWheel(asio::io_context& context)
+  : asio::io_context::service(context), shared(shared_contexts_), timer(context) {
+  schedule();
+}
+
+void TimerWheel::shutdown() {
+  auto locker = lock();
+  stopped = true;
+}
+
+std::unique_lock<std::mutex> TimerWheel::lock() {
+  return shared ? std::unique_lock(mx) : std::unique_lock<std::mutex>();
+}
+
+void TimerWheel::drain() {
+  draining_.store(true, std::memory_order_relaxed);
+  auto locker = lock();
+  auto now = current.load(std::memory_order_relaxed);
+  for (auto first : slots)
+    for (auto timer = first; timer; timer = timer->next)
+      if (timer->idle.load(std::memory_order_relaxed))
+        timer->deadline.store(now, std::memory_order_relaxed);
+}
+
+void TimerWheel::add(ConnectionTimer& timer) {
+  auto locker = lock();
+  insert(timer, current.load(std::memory_order_relaxed) + revisit_ticks);
+}
+
+void TimerWheel::remove(ConnectionTimer& timer) {
+  auto locker = lock();
+  if (timer.prev)
+    timer.prev->next = timer.next;
+  else
+    slots[timer.slot] = timer.next;
+  if (timer.next)
+    timer.next->prev = timer.prev;
+}
+
+void TimerWheel::insert(ConnectionTimer& timer, uint64_t tick_number) {
+  timer.slot = size_t(tick_number % slot_count);
+  timer.prev = nullptr;
+  timer.next = slots[timer.slot];
+  if (timer.next)
+    timer.next->prev = &timer;
+  slots[timer.slot] = &timer;
+}
+
+void TimerWheel::schedule() {
+  timer.expires_after(tick);
+  auto handler = [this](std::error_code ec) {
+    if (ec)
+      return;
+    advance();
+    schedule();
+  };
+  timer.async_wait(PooledHandler<decltype(handler)>(std::move(handler)));
+}
+
+void TimerWheel::expire(ConnectionTimer& timer) {
+  timer.expired_.store(true, std::memory_order_relaxed);
+  if (!timer.alive) {
+    timer.cancel(timer.socket);
+    return;
+  }
+  // the socket is used by the thread running the connection's strand, it's cancelled there
+  auto handler = [alive = timer.alive, socket = timer.socket, cancel = timer.cancel] {
+    if (*alive)
+      cancel(socket);
+  };
+  asio::post(timer.executor, PooledHandler<decltype(handler)>(std::move(handler)));
+}
+
+void TimerWheel::advance() {
+  auto locker = lock();
+  if (stopped)
+    return;
+  auto now = current.load(std::memory_order_relaxed) + 1;
+  current.store(now, std::memory_order_relaxed);
+  auto& slot = slots[now % slot_count];
+  auto timer = std::exchange(slot, nullptr);
+  while (timer) {
+    auto next = timer->next;
+    auto deadline = timer->deadline.load(std::memory_order_relaxed);
+    if (deadline <= now) {
+      expire(*timer);
+      insert(*timer, now + 1);
+    }
+    else
+      insert(*timer, std::min(deadline, now + revisit_ticks));
+    timer = next;
+  }
+}
+
+ConnectionTimer::ConnectionTimer(
+  asio::io_context& context, const asio::executor& executor, void* socket, void (*cancel)(void*))
+  : wheel(asio::use_service<TimerWheel>(context)), socket(socket), cancel(cancel), executor(executor) {
+  if (wheel.shared)
+    alive = std::allocate_shared<bool>(PoolAllocator<bool>{}, true);
+  wheel.add(*this);
+}
+
+ConnectionTimer::~ConnectionTimer() {
+  wheel.remove(*this);
+  // runs on the connection's strand like the posted cancellations
+  if (alive)
+    *alive = false;
+}
+
+void ConnectionTimer::expires_after(std::chrono::seconds timeout, bool idle_connection) {
+  idle.store(idle_connection, std::memory_order_relaxed);
+  auto now = wheel.now();
+  if (idle_connection && wheel.draining())
+    deadline.store(now, std::memory_order_relaxed);
+  else if (timeout.count() > 0)
+    // rounded up, the deadline passes a whole tick later at worst
+    deadline.store(now + 1 + uint64_t(timeout / TimerWheel::tick), std::memory_order_relaxed);
+  else
+    deadline.store(TimerWheel::never, std::memory_order_relaxed);
+}
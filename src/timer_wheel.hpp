@@ -0,0 +1,117 @@
+#pragma once
+#include <asio.hpp>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+class ConnectionTimer;
+
+// the io_contexts are run by several threads (shared mode with more than one thread); call before
+// the servers start
+void set_shared_contexts(bool shared);
+bool shared_contexts();
+
+// coarse timer wheel of an io_context for the connection timeouts: arming a deadline is one
+// relaxed store, a periodic tick visits only the entries of its slot. A visited entry whose deadline
+// hasn't passed goes to the slot of its deadline, but at most a second ahead, so a deadline moved
+// earlier is noticed within a second.
+// With one thread per io_context the wheel needs no locking. When several threads run the
+// io_context, connections register and unregister under the mutex of the wheel, and the tick, which
+// may run on another thread than a connection, posts the cancellation to the connection's strand
+class TimerWheel : public asio::io_context::service
+{
+public:
+  static asio::io_context::id id;
+
+  static constexpr std::chrono::milliseconds tick{ 100 };
+  static constexpr uint64_t revisit_ticks = 10;
+  static constexpr size_t slot_count = 16;  // more than revisit_ticks
+  static constexpr uint64_t never = UINT64_MAX;
+
+  explicit TimerWheel(asio::io_context& context);
+
+  // ticks since the wheel started
+  uint64_t now() const {
+    return current.load(std::memory_order_relaxed);
+  }
+  // expires the connections waiting for a request, later idle ones on their next tick
+  void drain();
+  bool draining() const {
+    return draining_.load(std::memory_order_relaxed);
+  }
+
+private:
+  friend class ConnectionTimer;
+
+  void shutdown() override;
+  std::unique_lock<std::mutex> lock();
+  void expire(ConnectionTimer& timer);
+  void add(ConnectionTimer& timer);
+  void remove(ConnectionTimer& timer);
+  void insert(ConnectionTimer& timer, uint64_t tick_number);
+  void schedule();
+  void advance();
+
+  // the tick and the connections may run on different threads of a shared io_context
+  const bool shared;
+  std::mutex mx;
+  std::array<ConnectionTimer*, slot_count> slots{};
+  asio::steady_timer timer;
+  std::atomic<uint64_t> current{ 0 };
+  std::atomic<bool> draining_{ false };
+  bool stopped = false;
+};
+
+// deadline of one connection, registered with the wheel of its io_context for its whole life.
+// When it passes, the operations of the socket are cancelled, and again on every tick until the
+// timer is destroyed, so an operation started right after a cancellation doesn't wait forever
+class ConnectionTimer
+{
+public:
+  // Socket is asio::ip::tcp::socket or UringSocket; executor runs the connection, a strand when
+  // the io_context is shared by several threads
+  template <class Socket>
+  ConnectionTimer(Socket& socket, const asio::executor& executor)
+    : ConnectionTimer(static_cast<asio::io_context&>(socket.get_executor().context()), executor, &socket,
+        [](void* socket) {
+          std::error_code ec;
+          static_cast<Socket*>(socket)->cancel(ec);
+        }) {
+  }
+  ConnectionTimer(const ConnectionTimer&) = delete;
+  ConnectionTimer& operator=(const ConnectionTimer&) = delete;
+  ~ConnectionTimer();
+
+  // deadline after timeout from now, none if timeout is 0; an idle connection is waiting for
+  // its next request and is closed right away when the server drains
+  void expires_after(std::chrono::seconds timeout, bool idle = false);
+  bool expired() const {
+    return expired_.load(std::memory_order_relaxed);
+  }
+  // the server stops, the connection should end after its current request
+  bool draining() const {
+    return wheel.draining();
+  }
+
+private:
+  friend class TimerWheel;
+
+  ConnectionTimer(asio::io_context& context, const asio::executor& executor, void* socket, void (*cancel)(void*));
+
+  TimerWheel& wheel;
+  void* socket;
+  void (*cancel)(void* socket);
+  asio::executor executor;
+  // shared mode: cleared by the destructor, cancellations posted to the strand are dropped after it
+  std::shared_ptr<bool> alive;
+  std::atomic<uint64_t> deadline{ TimerWheel::never };  // tick number
+  std::atomic<bool> idle{ false };
+  std::atomic<bool> expired_{ false };
+  // slot list of the wheel, guarded by its mutex
+  ConnectionTimer* prev = nullptr;
+  ConnectionTimer* next = nullptr;
+  size_t slot = 0;
+};
@@ -0,0 +1,548 @@
+#ifdef HAS_IO_URING
+#include "uring.hpp"
+#include "assets.hpp"
+#include "log.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+
+int io_uring_setup(unsigned entries, io_uring_params& params) {
+  return int(::syscall(__NR_io_uring_setup, entries, &params));
+}
+
+int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+  return int(::syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+int io_uring_register(int fd, unsigned opcode, const void* arg, unsigned nr_args) {
+  return int(::syscall(__NR_io_uring_register, fd, opcode, arg, nr_args));
+}
+
+std::system_error last_error(const char* what) {
+  return { std::error_code(errno, std::system_category()), what };
+}
+
+template <class T>
+T* at_offset(void* base, uint32_t offset) {
+  return reinterpret_cast<T*>(static_cast<char*>(base) + offset);
+}
+
+void* map(size_t size, int fd = -1, off_t offset = 0) {
+  int flags = fd < 0 ? MAP_PRIVATE | MAP_ANONYMOUS : MAP_SHARED | MAP_POPULATE;
+  void* memory = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, flags, fd, offset);
+  if (memory == MAP_FAILED)
+    throw last_error("io_uring mmap");
+  return memory;
+}
+
+// copies of the preloaded asset bodies registered with every ring: fixed buffers must be
+// anonymous memory, while the embedded assets are mapped from the executable
+struct RegisteredAsset {
+  const char* body = nullptr;
+  size_t size = 0;
+  std::vector<char> copy;
+};
+
+const std::vector<RegisteredAsset>& registered_assets() {
+  static const auto assets = [] {
+    std::vector<RegisteredAsset> assets;
+    for (size_t id = 0; id < size_t(AssetId::count); ++id) {
+      auto& asset = get_asset(AssetId(id));
+      for (auto variant : { &asset.identity, &asset.gzip }) {
+        if (variant->body.empty())
+          continue;
+        auto& registered = assets.emplace_back();
+        registered.body = variant->body.data();
+        registered.size = variant->body.size();
+        registered.copy.assign(variant->body.begin(), variant->body.end());
+      }
+    }
+    return assets;
+  }();
+  return assets;
+}
+
+}  // namespace
+
+asio::io_context::id UringService::id;
+
+UringService::UringService(asio::io_context& context)
+  : asio::io_context::service(context), context_(context), ring_events(context) {
+  constexpr unsigned entries = 1024;
+  constexpr unsigned completion_entries = 8 * entries;  // multishot entries complete many times
+  io_uring_params params{};
+  params.flags = IORING_SETUP_SUBMIT_ALL | IORING_SETUP_CQSIZE;
+  params.cq_entries = completion_entries;
+  ring_fd = io_uring_setup(entries, params);
+  if (ring_fd < 0)
+    throw last_error("io_uring_setup");
+  if (!(params.features & IORING_FEAT_NODROP))
+    throw std::runtime_error("io_uring without IORING_FEAT_NODROP is not supported");
+
+  sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP)
+    sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+  sq_ring = map(sq_ring_size, ring_fd, IORING_OFF_SQ_RING);
+  cq_ring = params.features & IORING_FEAT_SINGLE_MMAP ? sq_ring : map(cq_ring_size, ring_fd, IORING_OFF_CQ_RING);
+  sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+  sqes = static_cast<io_uring_sqe*>(map(sqes_size, ring_fd, IORING_OFF_SQES));
+
+  sq_head = at_offset<unsigned>(sq_ring, params.sq_off.head);
+  sq_tail = at_offset<unsigned>(sq_ring, params.sq_off.tail);
+  sq_flags = at_offset<unsigned>(sq_ring, params.sq_off.flags);
+  sq_mask = *at_offset<unsigned>(sq_ring, params.sq_off.ring_mask);
+  sq_entries = params.sq_entries;
+  // entries are always used in ring order, so the indirection array is the identity
+  auto array = at_offset<unsigned>(sq_ring, params.sq_off.array);
+  for (unsigned i = 0; i < sq_entries; ++i)
+    array[i] = i;
+  prepared = submitted = *sq_tail;
+
+  cq_head = at_offset<unsigned>(cq_ring, params.cq_off.head);
+  cq_tail = at_offset<unsigned>(cq_ring, params.cq_off.tail);
+  cq_mask = *at_offset<unsigned>(cq_ring, params.cq_off.ring_mask);
+  cqes = at_offset<io_uring_cqe>(cq_ring, params.cq_off.cqes);
+
+  setup_read_buffers();
+  register_assets();
+
+  // the reactor reports the ring fd readable when there are completions to reap
+  int events_fd = ::fcntl(ring_fd, F_DUPFD_CLOEXEC, 0);
+  if (events_fd < 0)
+    throw last_error("io_uring fd dup");
+  ring_events.assign(events_fd);
+  wait_completions();
+}
+
+UringService::~UringService() {
+  std::error_code ec;
+  ring_events.close(ec);
+  if (read_buffers)
+    ::munmap(read_buffers, size_t(read_buffer_count) * read_buffer_size);
+  if (read_ring)
+    ::munmap(read_ring, read_buffer_count * sizeof(io_uring_buf));
+  if (sqes)
+    ::munmap(sqes, sqes_size);
+  if (cq_ring && cq_ring != sq_ring)
+    ::munmap(cq_ring, cq_ring_size);
+  if (sq_ring)
+    ::munmap(sq_ring, sq_ring_size);
+  if (ring_fd >= 0)
+    ::close(ring_fd);
+}
+
+void UringService::setup_read_buffers() {
+  static_assert((read_buffer_count & (read_buffer_count - 1)) == 0, "ring size must be a power of two");
+  read_ring = static_cast<io_uring_buf_ring*>(map(read_buffer_count * sizeof(io_uring_buf)));
+  read_buffers = static_cast<char*>(map(size_t(read_buffer_count) * read_buffer_size));
+  io_uring_buf_reg reg{};
+  reg.ring_addr = reinterpret_cast<uint64_t>(read_ring);
+  reg.ring_entries = read_buffer_count;
+  reg.bgid = read_buffer_group;
+  if (io_uring_register(ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+    throw last_error("io_uring provided buffer ring");
+  for (unsigned id = 0; id < read_buffer_count; ++id)
+    recycle_read_buffer(uint16_t(id));
+}
+
+void UringService::recycle_read_buffer(uint16_t id) {
+  // not read_ring->bufs: in C++ the flexible array of the kernel header is placed after an empty struct
+  auto& buffer = reinterpret_cast<io_uring_buf*>(read_ring)[read_ring_tail & (read_buffer_count - 1)];
+  buffer.addr = reinterpret_cast<uint64_t>(read_buffer(id));
+  buffer.len = read_buffer_size;
+  buffer.bid = id;
+  std::atomic_ref<uint16_t>(read_ring->tail).store(++read_ring_tail, std::memory_order_release);
+}
+
+void UringService::register_assets() {
+  auto& assets = registered_assets();
+  std::vector<iovec> iovecs;
+  for (auto& asset : assets)
+    iovecs.push_back({ const_cast<char*>(asset.copy.data()), asset.copy.size() });
+  // pinned memory counts against RLIMIT_MEMLOCK, assets are sent as ordinary buffers without it
+  if (io_uring_register(ring_fd, IORING_REGISTER_BUFFERS, iovecs.data(), unsigned(iovecs.size())) < 0)
+    log_warning(0, "can't register asset buffers with io_uring: {}", std::generic_category().message(errno));
+  else
+    assets_registered = true;
+}
+
+int UringService::registered_buffer(const void* data, size_t size, const char*& fixed_data) const {
+  if (!assets_registered)
+    return -1;
+  auto begin = static_cast<const char*>(data);
+  auto& assets = registered_assets();
+  for (size_t i = 0; i < assets.size(); ++i) {
+    auto& asset = assets[i];
+    if (begin >= asset.body && begin + size <= asset.body + asset.size) {
+      fixed_data = asset.copy.data() + (begin - asset.body);
+      return int(i);
+    }
+  }
+  return -1;
+}
+
+io_uring_sqe& UringService::prepare(UringCompletion& target) {
+  auto& sqe = prepare();
+  sqe.user_data = reinterpret_cast<uint64_t>(&target);
+  return sqe;
+}
+
+io_uring_sqe& UringService::prepare() {
+  // a full queue is handed to the kernel right away
+  if (prepared - std::atomic_ref<unsigned>(*sq_head).load(std::memory_order_acquire) == sq_entries)
+    submit();
+  auto& sqe = sqes[prepared++ & sq_mask];
+  std::memset(&sqe, 0, sizeof(sqe));
+  schedule_submit();
+  return sqe;
+}
+
+void UringService::start(UringOp& op) {
+  op.prev = nullptr;
+  op.next = pending;
+  if (pending)
+    pending->prev = &op;
+  pending = &op;
+}
+
+void UringService::finish(UringOp& op) {
+  if (op.prev)
+    op.prev->next = op.next;
+  else
+    pending = op.next;
+  if (op.next)
+    op.next->prev = op.prev;
+}
+
+void UringService::schedule_submit() {
+  if (submit_posted || stopped)
+    return;
+  submit_posted = true;
+  auto handler = [this] {
+    submit_posted = false;
+    if (!stopped)
+      submit();
+  };
+  asio::post(context_, PooledHandler<decltype(handler)>(std::move(handler)));
+}
+
+void UringService::submit() {
+  std::atomic_ref<unsigned>(*sq_tail).store(prepared, std::memory_order_release);
+  // completions that didn't fit into the queue are flushed by the kernel on entering with GETEVENTS
+  unsigned flags = std::atomic_ref<unsigned>(*sq_flags).load(std::memory_order_relaxed) & IORING_SQ_CQ_OVERFLOW
+    ? IORING_ENTER_GETEVENTS : 0;
+  while (prepared != submitted || flags) {
+    int res = io_uring_enter(ring_fd, prepared - submitted, 0, flags);
+    if (res >= 0) {
+      submitted += unsigned(res);
+      flags = 0;
+    }
+    else if (errno == EAGAIN || errno == EBUSY) {
+      // out of resources until completions are reaped: try again on the next turn
+      schedule_submit();
+      return;
+    }
+    else if (errno != EINTR)
+      throw last_error("io_uring_enter");
+  }
+}
+
+void UringService::wait_completions() {
+  auto handler = [this](std::error_code ec) {
+    if (ec || stopped)
+      return;
+    reap();
+    submit();
+    wait_completions();
+  };
+  ring_events.async_wait(asio::posix::stream_descriptor::wait_read, PooledHandler<decltype(handler)>(std::move(handler)));
+}
+
+void UringService::reap() {
+  unsigned head = *cq_head;
+  unsigned tail;
+  // handlers may submit and so produce more completions
+  while (head != (tail = std::atomic_ref<unsigned>(*cq_tail).load(std::memory_order_acquire))) {
+    for (; head != tail && !stopped; ++head) {
+      auto& cqe = cqes[head & cq_mask];
+      auto target = reinterpret_cast<UringCompletion*>(cqe.user_data);
+      int res = cqe.res;
+      uint32_t flags = cqe.flags;
+      std::atomic_ref<unsigned>(*cq_head).store(head + 1, std::memory_order_release);
+      if (target)
+        target->complete(res, flags);
+    }
+    if (stopped)
+      return;
+  }
+}
+
+void UringService::shutdown() {
+  stopped = true;
+  while (pending)
+    pending->destroy();
+}
+
+namespace detail {
+
+void UringWrite::start(int fd) {
+  if (!count) {
+    // nothing to write, the completion is still delivered through the ring
+    part_count = 1;
+    parts[0] = {};
+    parts[0].write = this;
+    service.prepare(parts[0]).opcode = IORING_OP_NOP;
+    return;
+  }
+  io_uring_sqe* previous = nullptr;
+  size_t message_count = 0;
+  for (size_t i = 0; i < count;) {
+    auto& part = parts[part_count++];
+    part = {};
+    part.write = this;
+    auto& sqe = service.prepare(part);
+    sqe.fd = fd;
+    const char* fixed_data = nullptr;
+    int fixed = service.registered_buffer(buffers[i].data(), buffers[i].size(), fixed_data);
+    if (fixed >= 0) {
+      sqe.opcode = IORING_OP_WRITE_FIXED;
+      sqe.addr = reinterpret_cast<uint64_t>(fixed_data);
+      sqe.len = uint32_t(buffers[i].size());
+      sqe.off = uint64_t(-1);
+      sqe.buf_index = uint16_t(fixed);
+      part.size = buffers[i].size();
+      ++i;
+    }
+    else {
+      // run of ordinary buffers up to the next registered one
+      size_t first = i;
+      const char* unused;
+      for (; i < count && (i == first || service.registered_buffer(buffers[i].data(), buffers[i].size(), unused) < 0); ++i) {
+        iovecs[i] = { const_cast<void*>(buffers[i].data()), buffers[i].size() };
+        part.size += buffers[i].size();
+      }
+      auto& message = messages[message_count++];
+      message = {};
+      message.msg_iov = &iovecs[first];
+      message.msg_iovlen = i - first;
+      sqe.opcode = IORING_OP_SENDMSG;
+      sqe.addr = reinterpret_cast<uint64_t>(&message);
+      sqe.len = 1;
+      // all or an error, so a short send breaks the chain
+      sqe.msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+    }
+    if (previous)
+      previous->flags |= IOSQE_IO_LINK;
+    previous = &sqe;
+  }
+}
+
+void UringWrite::Part::complete(int result, uint32_t) {
+  res = result;
+  write->part_done();
+}
+
+void UringWrite::part_done() {
+  if (++parts_done == part_count)
+    done.complete(0, 0);
+}
+
+void UringWrite::result(std::error_code& ec, size_t& size) const {
+  size = 0;
+  for (size_t i = 0; i < part_count; ++i) {
+    auto& part = parts[i];
+    if (part.res < 0) {
+      // entries after a short or failed one are cancelled, asio::async_write goes on after the bytes written
+      if (size == 0 && part.res != -ECANCELED)
+        ec = std::error_code(-part.res, std::system_category());
+      return;
+    }
+    size += size_t(part.res);
+    if (size_t(part.res) < part.size)
+      return;
+  }
+}
+
+}  // namespace detail
+
+UringSocket::UringSocket(UringSocket&& other) noexcept
+  : service(other.service),
+    fd(std::exchange(other.fd, -1)),
+    kept_buffer(std::exchange(other.kept_buffer, -1)),
+    kept_offset(other.kept_offset),
+    kept_size(other.kept_size) {
+}
+
+UringSocket::~UringSocket() {
+  if (kept_buffer >= 0)
+    service->recycle_read_buffer(uint16_t(kept_buffer));
+  if (fd >= 0)
+    ::close(fd);
+}
+
+void UringSocket::native_non_blocking(bool mode, std::error_code& ec) {
+  int value = mode;
+  ec = ::ioctl(fd, FIONBIO, &value) ? std::error_code(errno, std::system_category()) : std::error_code{};
+}
+
+void UringSocket::cancel(std::error_code& ec) {
+  auto& sqe = service->prepare();
+  sqe.opcode = IORING_OP_ASYNC_CANCEL;
+  sqe.fd = fd;
+  sqe.cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+  ec = {};
+}
+
+void UringSocket::shutdown(asio::socket_base::shutdown_type what, std::error_code& ec) {
+  ec = ::shutdown(fd, int(what)) ? std::error_code(errno, std::system_category()) : std::error_code{};
+}
+
+asio::ip::tcp::endpoint UringSocket::remote_endpoint(std::error_code& ec) const {
+  asio::ip::tcp::endpoint endpoint;
+  socklen_t size = socklen_t(endpoint.capacity());
+  if (::getpeername(fd, endpoint.data(), &size))
+    ec = std::error_code(errno, std::system_category());
+  else
+    endpoint.resize(size);
+  return endpoint;
+}
+
+bool UringSocket::take_received(asio::mutable_buffer buffer, size_t& size) {
+  if (kept_buffer < 0)
+    return false;
+  size = std::min(kept_size, buffer.size());
+  std::memcpy(buffer.data(), service->read_buffer(uint16_t(kept_buffer)) + kept_offset, size);
+  kept_offset += size;
+  kept_size -= size;
+  if (!kept_size) {
+    service->recycle_read_buffer(uint16_t(kept_buffer));
+    kept_buffer = -1;
+  }
+  return true;
+}
+
+void UringSocket::submit_receive(UringCompletion& op, asio::mutable_buffer buffer, bool direct) {
+  auto& sqe = service->prepare(op);
+  sqe.opcode = IORING_OP_RECV;
+  sqe.fd = fd;
+  if (direct) {
+    sqe.addr = reinterpret_cast<uint64_t>(buffer.data());
+    sqe.len = uint32_t(buffer.size());
+  }
+  else {
+    sqe.flags = IOSQE_BUFFER_SELECT;
+    sqe.buf_group = UringService::read_buffer_group;
+  }
+}
+
+bool UringSocket::received(
+  UringCompletion& op, int res, uint32_t flags, asio::mutable_buffer buffer, std::error_code& ec, size_t& size) {
+  if (res == -ENOBUFS) {
+    // all provided buffers are taken, read straight into the caller's buffer
+    submit_receive(op, buffer, true);
+    return false;
+  }
+  if (res < 0)
+    ec = std::error_code(-res, std::system_category());
+  else if (res == 0)
+    ec = asio::error::eof;
+  else if (flags & IORING_CQE_F_BUFFER) {
+    kept_buffer = int(flags >> IORING_CQE_BUFFER_SHIFT);
+    kept_offset = 0;
+    kept_size = size_t(res);
+    take_received(buffer, size);
+  }
+  else
+    size = size_t(res);
+  return true;
+}
+
+UringAcceptor::UringAcceptor(UringService& service, asio::ip::tcp::acceptor&& acceptor, bool multishot)
+  : service(service), acceptor(std::move(acceptor)), multishot_accept(multishot) {
+  if (multishot_accept)
+    submit();
+}
+
+UringAcceptor::~UringAcceptor() {
+  if (waiter)
+    waiter->destroy();
+  for (int fd : ready)
+    ::close(fd);
+  if (pending && service.stopping()) {
+    pending->~AcceptCompletion();
+    pool_deallocate(pending, sizeof(AcceptCompletion));
+  }
+  else if (pending) {
+    // the kernel ends the accept with a last completion, the completion frees itself then
+    pending->acceptor = nullptr;
+    auto& sqe = service.prepare();
+    sqe.opcode = IORING_OP_ASYNC_CANCEL;
+    sqe.addr = reinterpret_cast<uint64_t>(pending);
+  }
+}
+
+void UringAcceptor::cancel(std::error_code& ec) {
+  if (waiter)
+    std::exchange(waiter, nullptr)->complete(-ECANCELED, 0);
+  ec = {};
+}
+
+void UringAcceptor::submit() {
+  pending = new (pool_allocate(sizeof(AcceptCompletion))) AcceptCompletion{};
+  pending->acceptor = this;
+  auto& sqe = service.prepare(*pending);
+  sqe.opcode = IORING_OP_ACCEPT;
+  sqe.fd = acceptor.native_handle();
+  sqe.ioprio = multishot_accept ? IORING_ACCEPT_MULTISHOT : 0;
+  sqe.accept_flags = SOCK_CLOEXEC;
+}
+
+void UringAcceptor::AcceptCompletion::complete(int res, uint32_t flags) {
+  bool more = flags & IORING_CQE_F_MORE;
+  if (acceptor) {
+    acceptor->accepted(res, flags);
+    return;
+  }
+  if (res >= 0)
+    ::close(res);
+  if (!more) {
+    this->~AcceptCompletion();
+    pool_deallocate(this, sizeof(AcceptCompletion));
+  }
+}
+
+void UringAcceptor::accepted(int res, uint32_t flags) {
+  if (!(flags & IORING_CQE_F_MORE)) {
+    auto self = std::exchange(pending, nullptr);
+    self->~AcceptCompletion();
+    pool_deallocate(self, sizeof(AcceptCompletion));
+    // the kernel stopped the multishot accept (an error or an overflowing completion queue), start
+    // again; a single accept is submitted by the next async_accept
+    if (multishot_accept)
+      submit();
+  }
+  if (waiter)
+    std::exchange(waiter, nullptr)->complete(res, 0);
+  else if (res >= 0)
+    ready.push_back(res);  // a single accept completes without a waiter only after a cancel
+  else
+    error = std::error_code(-res, std::system_category());
+}
+
+int UringAcceptor::pop_ready() {
+  int fd = ready.front();
+  ready.pop_front();
+  return fd;
+}
+
+#endif
@@ -0,0 +1,423 @@
+#pragma once
+#ifdef HAS_IO_URING
+#include "allocator.hpp"
+#include "asio_pool.hpp"
+#include <asio.hpp>
+#include <array>
+#include <cstdint>
+#include <deque>
+#include <new>
+#include <system_error>
+#include <utility>
+#include <vector>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+// io_uring backend (--backend=uring): sockets with the same asynchronous interface as
+// asio::ip::tcp::socket, so the connection coroutines are shared with the asio backend
+
+// target of a completion queue entry, passed as its user_data
+class UringCompletion
+{
+public:
+  virtual void complete(int res, uint32_t flags) = 0;
+
+protected:
+  ~UringCompletion() = default;
+};
+
+// operation owning a completion handler; pending ones are destroyed without being
+// invoked when the io_context shuts down, like asio does with its own operations
+class UringOp : public UringCompletion
+{
+public:
+  virtual void destroy() = 0;
+
+  UringOp* prev = nullptr;
+  UringOp* next = nullptr;
+
+protected:
+  ~UringOp() = default;
+};
+
+// one ring per io_context, used only from the thread running it (sharded mode or one thread).
+// Entries prepared during an event loop turn are submitted with one io_uring_enter at its end,
+// completions are reaped when the reactor reports the ring fd readable
+class UringService : public asio::io_context::service
+{
+public:
+  static asio::io_context::id id;
+
+  // reads select a buffer from this group when data arrives, so idle connections hold none
+  static constexpr size_t read_buffer_size = 4096;
+  static constexpr unsigned read_buffer_count = 1024;
+  static constexpr uint16_t read_buffer_group = 0;
+
+  explicit UringService(asio::io_context& context);
+  ~UringService();
+
+  asio::io_context& context() {
+    return context_;
+  }
+  // the io_context is shutting down: nothing more is submitted
+  bool stopping() const {
+    return stopped;
+  }
+
+  // zeroed submission entry completing to target; the completion of an entry without a target is ignored
+  io_uring_sqe& prepare(UringCompletion& target);
+  io_uring_sqe& prepare();
+
+  void start(UringOp& op);
+  void finish(UringOp& op);
+
+  const char* read_buffer(uint16_t id) const {
+    return read_buffers + size_t(id) * read_buffer_size;
+  }
+  void recycle_read_buffer(uint16_t id);
+
+  // index of the registered buffer (a preloaded asset) holding [data, data + size) and the
+  // address of the data in it; -1 if the data is not registered
+  int registered_buffer(const void* data, size_t size, const char*& fixed_data) const;
+
+private:
+  void shutdown() override;
+  void submit();
+  void schedule_submit();
+  void wait_completions();
+  void reap();
+  void setup_read_buffers();
+  void register_assets();
+
+  asio::io_context& context_;
+  int ring_fd = -1;
+  asio::posix::stream_descriptor ring_events;  // duplicate of ring_fd watched by the reactor
+  bool submit_posted = false;
+  bool stopped = false;
+  UringOp* pending = nullptr;
+
+  // submission queue
+  void* sq_ring = nullptr;
+  size_t sq_ring_size = 0;
+  unsigned* sq_head = nullptr;
+  unsigned* sq_tail = nullptr;
+  unsigned* sq_flags = nullptr;
+  unsigned sq_mask = 0;
+  unsigned sq_entries = 0;
+  io_uring_sqe* sqes = nullptr;
+  size_t sqes_size = 0;
+  unsigned prepared = 0;   // local tail
+  unsigned submitted = 0;  // entries handed to the kernel
+
+  // completion queue
+  void* cq_ring = nullptr;
+  size_t cq_ring_size = 0;
+  unsigned* cq_head = nullptr;
+  unsigned* cq_tail = nullptr;
+  unsigned cq_mask = 0;
+  io_uring_cqe* cqes = nullptr;
+
+  // provided read buffers
+  io_uring_buf_ring* read_ring = nullptr;
+  char* read_buffers = nullptr;
+  uint16_t read_ring_tail = 0;
+
+  bool assets_registered = false;
+};
+
+namespace detail {
+
+template <class Op, class... Args>
+Op* make_uring_op(Args&&... args) {
+  return new (pool_allocate(sizeof(Op))) Op(std::forward<Args>(args)...);
+}
+
+// base of operations owning a completion handler, allocated from the per-thread pool
+template <class Derived, class Handler>
+class UringHandlerOp : public UringOp
+{
+public:
+  void destroy() override {
+    service.finish(*this);
+    auto self = static_cast<Derived*>(this);
+    self->~Derived();
+    pool_deallocate(self, sizeof(Derived));
+  }
+
+protected:
+  UringHandlerOp(UringService& service, Handler&& handler) : service(service), handler(std::move(handler)) {
+    service.start(*this);
+  }
+  ~UringHandlerOp() = default;
+
+  // the operation is freed before the handler runs, so the handler may start the next one
+  template <class... Args>
+  void invoke(Args... args) {
+    auto h = std::move(handler);
+    destroy();
+    h(std::move(args)...);
+  }
+
+  UringService& service;
+  Handler handler;
+};
+
+// completion that can't be delivered from the initiating function is posted
+template <class Handler, class... Args>
+void post_completion(asio::io_context& context, Handler&& handler, Args... args) {
+  auto bound = [handler = std::move(handler), ... args = std::move(args)]() mutable { handler(std::move(args)...); };
+  asio::post(context, PooledHandler<decltype(bound)>(std::move(bound)));
+}
+
+// gathered write of up to max_buffers buffers as a chain of linked entries: runs of ordinary
+// buffers as one sendmsg, registered buffers as write_fixed; the result is the number of bytes
+// up to the first short or failed entry, asio::async_write continues from there
+class UringWrite
+{
+public:
+  static constexpr size_t max_buffers = 64;
+
+  UringWrite(UringService& service, UringCompletion& done) : service(service), done(done) {
+  }
+
+  void add(asio::const_buffer buffer) {
+    if (count < max_buffers && buffer.size())
+      buffers[count++] = buffer;
+  }
+  void start(int fd);
+  void result(std::error_code& ec, size_t& size) const;
+
+private:
+  struct Part : UringCompletion {
+    void complete(int res, uint32_t flags) override;
+
+    UringWrite* write = nullptr;
+    size_t size = 0;  // bytes the entry should write
+    int res = 0;
+  };
+
+  void part_done();
+
+  UringService& service;
+  UringCompletion& done;
+  std::array<asio::const_buffer, max_buffers> buffers;
+  size_t count = 0;
+  std::array<iovec, max_buffers> iovecs;
+  std::array<msghdr, max_buffers> messages;
+  std::array<Part, max_buffers> parts;
+  size_t part_count = 0;
+  size_t parts_done = 0;
+};
+
+}  // namespace detail
+
+class UringSocket
+{
+public:
+  using executor_type = asio::io_context::executor_type;
+
+  UringSocket(UringService& service, int fd) : service(&service), fd(fd) {
+  }
+  UringSocket(UringSocket&& other) noexcept;
+  UringSocket& operator=(UringSocket&&) = delete;
+  ~UringSocket();
+
+  executor_type get_executor() {
+    return service->context().get_executor();
+  }
+  int native_handle() const {
+    return fd;
+  }
+  void native_non_blocking(bool mode, std::error_code& ec);
+  // pending operations complete with operation_aborted
+  void cancel(std::error_code& ec);
+  void shutdown(asio::socket_base::shutdown_type what, std::error_code& ec);
+  asio::ip::tcp::endpoint remote_endpoint(std::error_code& ec) const;
+
+  // receives into a provided buffer and copies to buffers; data that doesn't fit is kept for the next read
+  template <class MutableBuffers, class Token>
+  auto async_read_some(const MutableBuffers& buffers, Token&& token) {
+    return asio::async_initiate<Token, void(std::error_code, size_t)>(
+      [this](auto handler, asio::mutable_buffer buffer) {
+        using Op = ReadOp<decltype(handler)>;
+        size_t size = 0;
+        if (take_received(buffer, size))
+          detail::post_completion(service->context(), std::move(handler), std::error_code{}, size);
+        else
+          submit_receive(*detail::make_uring_op<Op>(*this, buffer, std::move(handler)), buffer, false);
+      },
+      token, asio::mutable_buffer(*asio::buffer_sequence_begin(buffers)));
+  }
+
+  template <class ConstBuffers, class Token>
+  auto async_write_some(const ConstBuffers& buffers, Token&& token) {
+    return asio::async_initiate<Token, void(std::error_code, size_t)>(
+      [this, &buffers](auto handler) {
+        auto op = detail::make_uring_op<WriteOp<decltype(handler)>>(*service, std::move(handler));
+        for (auto it = asio::buffer_sequence_begin(buffers); it != asio::buffer_sequence_end(buffers); ++it)
+          op->write.add(*it);
+        op->write.start(fd);
+      },
+      token);
+  }
+
+  template <class Token>
+  auto async_wait(asio::socket_base::wait_type what, Token&& token) {
+    return asio::async_initiate<Token, void(std::error_code)>(
+      [this, what](auto handler) {
+        auto op = detail::make_uring_op<WaitOp<decltype(handler)>>(*service, std::move(handler));
+        auto& sqe = service->prepare(*op);
+        sqe.opcode = IORING_OP_POLL_ADD;
+        sqe.fd = fd;
+        sqe.poll32_events = what == asio::socket_base::wait_write ? POLLOUT : what == asio::socket_base::wait_read ? POLLIN : POLLERR;
+      },
+      token);
+  }
+
+private:
+  template <class Handler>
+  class ReadOp final : public detail::UringHandlerOp<ReadOp<Handler>, Handler>
+  {
+  public:
+    ReadOp(UringSocket& socket, asio::mutable_buffer buffer, Handler&& handler)
+      : detail::UringHandlerOp<ReadOp, Handler>(*socket.service, std::move(handler)), socket(socket), buffer(buffer) {
+    }
+
+    void complete(int res, uint32_t flags) override {
+      std::error_code ec;
+      size_t size = 0;
+      if (socket.received(*this, res, flags, buffer, ec, size))
+        this->invoke(ec, size);
+    }
+
+  private:
+    UringSocket& socket;
+    asio::mutable_buffer buffer;
+  };
+
+  template <class Handler>
+  class WriteOp final : public detail::UringHandlerOp<WriteOp<Handler>, Handler>
+  {
+  public:
+    WriteOp(UringService& service, Handler&& handler)
+      : detail::UringHandlerOp<WriteOp, Handler>(service, std::move(handler)), write(service, *this) {
+    }
+
+    void complete(int, uint32_t) override {
+      std::error_code ec;
+      size_t size = 0;
+      write.result(ec, size);
+      this->invoke(ec, size);
+    }
+
+    detail::UringWrite write;
+  };
+
+  template <class Handler>
+  class WaitOp final : public detail::UringHandlerOp<WaitOp<Handler>, Handler>
+  {
+  public:
+    WaitOp(UringService& service, Handler&& handler) : detail::UringHandlerOp<WaitOp, Handler>(service, std::move(handler)) {
+    }
+
+    void complete(int res, uint32_t) override {
+      this->invoke(res < 0 ? std::error_code(-res, std::system_category()) : std::error_code{});
+    }
+  };
+
+  bool take_received(asio::mutable_buffer buffer, size_t& size);
+  void submit_receive(UringCompletion& op, asio::mutable_buffer buffer, bool direct);
+  // false if the receive is submitted again
+  bool received(UringCompletion& op, int res, uint32_t flags, asio::mutable_buffer buffer, std::error_code& ec, size_t& size);
+
+  UringService* service;
+  int fd = -1;
+  // rest of a provided buffer that didn't fit into the last read
+  int kept_buffer = -1;
+  size_t kept_offset = 0;
+  size_t kept_size = 0;
+};
+
+// accepts with one multishot accept, every connection completes the same submission entry, or
+// with a single accept per async_accept
+class UringAcceptor
+{
+public:
+  // the multishot accept takes connections from the listen backlog whenever they arrive, queued
+  // until async_accept asks for them. Under a connection limit that would empty the backlog past
+  // the limit, so a limited acceptor (multishot false) accepts one connection per async_accept
+  // instead, and the others wait in the backlog like with asio
+  UringAcceptor(UringService& service, asio::ip::tcp::acceptor&& acceptor, bool multishot = true);
+  UringAcceptor(const UringAcceptor&) = delete;
+  UringAcceptor& operator=(const UringAcceptor&) = delete;
+  ~UringAcceptor();
+
+  // a waiting async_accept completes with operation_aborted
+  void cancel(std::error_code& ec);
+
+  template <class Token>
+  auto async_accept(Token&& token) {
+    return asio::async_initiate<Token, void(std::error_code, UringSocket)>(
+      [this](auto handler) {
+        if (!ready.empty() || error) {
+          auto ec = std::exchange(error, {});
+          int fd = ec ? -1 : pop_ready();
+          detail::post_completion(service.context(), std::move(handler), ec, UringSocket{ service, fd });
+        }
+        else {
+          if (!pending)
+            submit();
+          waiter = detail::make_uring_op<AcceptOp<decltype(handler)>>(service, waiter, std::move(handler));
+        }
+      },
+      token);
+  }
+
+private:
+  template <class Handler>
+  class AcceptOp final : public detail::UringHandlerOp<AcceptOp<Handler>, Handler>
+  {
+  public:
+    AcceptOp(UringService& service, UringOp*& waiter, Handler&& handler)
+      : detail::UringHandlerOp<AcceptOp, Handler>(service, std::move(handler)), waiter(waiter) {
+    }
+    // the handler may own the acceptor, which must not destroy the operation again
+    ~AcceptOp() {
+      if (waiter == this)
+        waiter = nullptr;
+    }
+
+    void complete(int res, uint32_t) override {
+      if (res < 0)
+        this->invoke(std::error_code(-res, std::system_category()), UringSocket{ this->service, -1 });
+      else
+        this->invoke(std::error_code{}, UringSocket{ this->service, res });
+    }
+
+  private:
+    UringOp*& waiter;
+  };
+
+  // outlives the acceptor until the kernel ends the accept
+  struct AcceptCompletion : UringCompletion {
+    void complete(int res, uint32_t flags) override;
+
+    UringAcceptor* acceptor = nullptr;
+  };
+
+  void submit();
+  void accepted(int res, uint32_t flags);
+  int pop_ready();
+
+  UringService& service;
+  asio::ip::tcp::acceptor acceptor;
+  bool multishot_accept;
+  AcceptCompletion* pending = nullptr;  // accept submitted to the kernel
+  UringOp* waiter = nullptr;
+  std::deque<int> ready;  // connections accepted while nobody waited, oldest first
+  std::error_code error;
+};
+
+#endif
@@ -0,0 +1,77 @@
+// RequestParser fed in pieces: a request must parse the same wherever the reads split it
+#include "request.hpp"
+#include <fmt/format.h>
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using std::string;
+using std::string_view;
+
+namespace {
+
+int failures = 0;
+
+void check(bool condition, string_view what) {
+  if (!condition) {
+    fmt::print("FAILED: {}\n", what);
+    ++failures;
+  }
+}
+
+void receive(RequestParser& parser, string_view data) {
+  auto space = parser.prepare();
+  check(space.size() >= data.size(), "prepare leaves room for the test data");
+  std::memcpy(space.data(), data.data(), data.size());
+  parser.commit(data.size());
+}
+
+// feeds the pieces one read at a time and collects "method url body" of every complete request
+std::vector<string> parse(const std::vector<string_view>& pieces) {
+  RequestParser parser;
+  std::vector<string> requests;
+  for (auto piece : pieces) {
+    receive(parser, piece);
+    Request request;
+    RequestParser::Status status;
+    while ((status = parser.next(request)) == RequestParser::Status::complete)
+      requests.push_back(fmt::format("{} {} {}", request.method, request.url, request.body));
+    if (status == RequestParser::Status::error) {
+      requests.push_back("error");
+      break;
+    }
+  }
+  return requests;
+}
+
+constexpr string_view post = "POST /form HTTP/1.1\r\nContent-Length: 5\r\n\r\n";
+constexpr string_view get = "GET /next HTTP/1.1\r\nHost: x\r\n\r\n";
+
+}  // namespace
+
+int main() {
+  std::vector<string> expected = { "POST /form abcde" };
+  check(parse({ post, "ab", "cde" }) == expected, "body in reads after the header, split inside the body");
+  check(parse({ post, "abcde" }) == expected, "body in the read after the header");
+  check(parse({ post.substr(0, post.size() - 2), "\r\nab", "cde" }) == expected, "read split in the terminator");
+
+  // header and body followed by a pipelined request, split at every offset
+  string stream = fmt::format("{}abcde{}", post, get);
+  std::vector<string> both = { "POST /form abcde", "GET /next " };
+  for (size_t split = 0; split <= stream.size(); ++split) {
+    string_view view = stream;
+    check(parse({ view.substr(0, split), view.substr(split) }) == both, fmt::format("split at {}", split));
+  }
+  // and one byte per read
+  std::vector<string_view> bytes;
+  for (size_t i = 0; i < stream.size(); ++i)
+    bytes.push_back(string_view(stream).substr(i, 1));
+  check(parse(bytes) == both, "one byte per read");
+
+  if (failures)
+    return 1;
+  fmt::print("all request parser tests passed\n");
+  return 0;
+}